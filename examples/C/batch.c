@@ -0,0 +1,88 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define PRODUCERS 4
+#define NUM 50000
+#define BATCH 64
+
+coroc_coroutine_t init, worker;
+coroc_group_t group;
+
+int producer(void *arg) {
+  long msg[2] = {(long)arg, 0};
+
+  for (; msg[1] < NUM; msg[1]++) {
+    coroc_send(worker, msg, sizeof(msg));
+    if (msg[1] % 1024 == 0) coroc_coroutine_yield();
+  }
+
+  coroc_group_notify(group, 0);
+  return 0;
+}
+
+// drain the mailbox in batches until it is closed ..
+int consumer(void *arg) {
+  coroc_msg_item_t items[BATCH];
+  long last[PRODUCERS], total = 0, calls = 0;
+  int i, n, ret;
+
+  for (i = 0; i < PRODUCERS; i++) last[i] = -1;
+
+  while ((ret = coroc_recv_batch(items, BATCH, &n, true)) != CHAN_CLOSED) {
+    CHECK(ret == CHAN_SUCCESS && n > 0 && n <= BATCH);
+    for (i = 0; i < n; i++) {
+      long *msg = coroc_msg_item_data(items[i]);
+      CHECK(coroc_msg_item_size(items[i]) == sizeof(long) * 2);
+      CHECK(msg[1] == last[msg[0]] + 1);
+      last[msg[0]] = msg[1];
+    }
+    // the payloads stay in the items until they are freed ..
+    coroc_msg_batch_free(items, n);
+    total += n;
+    calls++;
+  }
+
+  printf("[consumer] received %ld messages in %ld calls.\n", total, calls);
+  coroc_send(init, &total, sizeof(total));
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  coroc_msg_item_t items[BATCH];
+  long i, total = 0;
+  int n, ret;
+
+  // a non-blocking batch gets the pending ones, or none ..
+  init = coroc_coroutine_self();
+  for (i = 0; i < 3; i++) coroc_send(init, &i, sizeof(i));
+  ret = coroc_recv_batch(items, BATCH, &n, false);
+  CHECK(ret == CHAN_SUCCESS && n == 3);
+  for (i = 0; i < 3; i++) CHECK(*(long *)coroc_msg_item_data(items[i]) == i);
+  coroc_msg_batch_free(items, n);
+  ret = coroc_recv_batch(items, BATCH, &n, false);
+  CHECK(ret == CHAN_BUSY && n == 0);
+
+  worker = coroc_coroutine_spawn(consumer, NULL, "consumer");
+  group = coroc_group_alloc();
+  for (i = 0; i < PRODUCERS; i++) {
+    coroc_group_add_task(group);
+    coroc_coroutine_spawn(producer, (void *)i, "producer");
+  }
+  coroc_group_sync(group);
+
+  // the pending messages are still received after the closing,
+  // then the consumer gets CHAN_CLOSED ..
+  coroc_chan_close((coroc_chan_t)worker);
+  coroc_recv(&total, sizeof(total), true);
+  CHECK(total == PRODUCERS * NUM);
+
+  printf("all the %ld messages are received.\n", total);
+  coroc_coroutine_exit(0);
+}
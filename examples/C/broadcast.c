@@ -0,0 +1,51 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+
+#define SUBSCRIBERS 8
+#define TICKS 1000
+
+coroc_group_t group;
+
+int subscriber(coroc_bcast_sub_t sub) {
+  int tick, sum = 0, count = 0;
+
+  while (coroc_bcast_recv(sub, &tick) != CHAN_CLOSED) {
+    sum += tick;
+    count++;
+  }
+
+  printf("[subscriber] recv %d ticks, sum is %d, lagged %llu\n", count, sum,
+         (long long unsigned)(sub->lagged));
+
+  coroc_bcast_unsubscribe(sub);
+  coroc_group_notify(group, 0);
+  coroc_coroutine_exit(0);
+}
+
+int main(int argc, char** argv) {
+  int i;
+  coroc_bcast_t bcast = coroc_bcast_allocate(sizeof(int), 16, TSC_BCAST_BLOCK);
+
+  group = coroc_group_alloc();
+
+  for (i = 0; i < SUBSCRIBERS; i++) {
+    coroc_group_add_task(group);
+    coroc_coroutine_spawn(subscriber, coroc_bcast_subscribe(bcast), "sub");
+  }
+
+  // publish each tick once for all the subscribers ..
+  for (i = 1; i <= TICKS; i++) coroc_bcast_publish(bcast, &i);
+
+  coroc_bcast_close(bcast);
+  coroc_group_sync(group);
+  free(group);
+
+  coroc_refcnt_put((coroc_refcnt_t)bcast);
+  coroc_coroutine_exit(0);
+}
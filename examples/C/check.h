@@ -0,0 +1,22 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#ifndef _TSC_EXAMPLE_CHECK_H_
+#define _TSC_EXAMPLE_CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// like the `assert', but never compiled out by the NDEBUG,
+// so never put the operations to be checked into the `cond' ..
+#define CHECK(cond)                                                      \
+  do {                                                                   \
+    if (!(cond)) {                                                       \
+      fprintf(stderr, "%s:%d: check `%s' failed\n", __FILE__, __LINE__, \
+              #cond);                                                    \
+      abort();                                                           \
+    }                                                                    \
+  } while (0)
+
+#endif  // _TSC_EXAMPLE_CHECK_H_
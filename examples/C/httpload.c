@@ -40,6 +40,7 @@ int main(int argc, char **argv) {
 int fetchtask(void *v) {
   int fd, n;
   char buf[512];
+  coroc_bufio_t bufio;
 
   fprintf(stderr, "starting...\n");
   for (;;) {
@@ -47,12 +48,25 @@ int fetchtask(void *v) {
       fprintf(stderr, "dial %s: %s\n", server, strerror(errno));
       continue;
     }
-    snprintf(buf, sizeof buf, "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", url,
-             server);
-    coroc_net_write(fd, buf, strlen(buf));
-    while ((n = coroc_net_read(fd, buf, sizeof buf)) > 0)
+    bufio = coroc_bufio_open(fd, 0);
+
+    // the request is flushed before reading the response ..
+    snprintf(buf, sizeof buf, "GET %s HTTP/1.0\r\n", url);
+    coroc_bufio_write(bufio, buf, strlen(buf));
+    snprintf(buf, sizeof buf, "Host: %s\r\n\r\n", server);
+    coroc_bufio_write(bufio, buf, strlen(buf));
+
+    // check the status line, then drain the rest with the large buffer ..
+    if ((n = coroc_bufio_read_until(bufio, '\n', buf, sizeof buf - 1)) > 0) {
+      buf[n] = 0;
+      if (strncmp(buf, "HTTP/", 5) != 0 || strstr(buf, " 200 ") == NULL)
+        fprintf(stderr, "%s", buf);
+    }
+    while ((n = coroc_bufio_read(bufio, buf, sizeof buf)) > 0)
       ;
-    close(fd);
+
+    coroc_bufio_free(bufio);
+    coroc_net_close(fd);
     write(1, ".", 1);
   }
 
@@ -0,0 +1,79 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define NUM 10000
+#define SMALL 64                       // stored in the pooled item
+#define LARGE (TSC_MSG_INLINE_MAX * 4)  // stored out of the item
+
+coroc_coroutine_t init;
+
+static inline int msg_size(int seq) { return (seq % 10 == 9) ? LARGE : SMALL; }
+
+static void msg_fill(char *buf, int seq) {
+  memset(buf, seq & 0xff, msg_size(seq));
+  memcpy(buf, &seq, sizeof(seq));
+}
+
+static void msg_check(const char *buf, int size, int seq) {
+  int i;
+  CHECK(size == msg_size(seq));
+  CHECK(memcmp(buf, &seq, sizeof(seq)) == 0);
+  for (i = sizeof(seq); i < size; i++) CHECK(buf[i] == (char)(seq & 0xff));
+}
+
+int producer(void *arg) {
+  char buf[LARGE];
+  int seq;
+
+  for (seq = 0; seq < NUM; seq++) {
+    if (seq % 3 == 2) {
+      // pass the ownership of a heap buffer, it is never copied ..
+      char *ptr = malloc(msg_size(seq));
+      msg_fill(ptr, seq);
+      coroc_sendp(init, ptr, msg_size(seq));
+    } else {
+      // the payload is copied into the pooled item, or to the receiver ..
+      msg_fill(buf, seq);
+      coroc_send(init, buf, msg_size(seq));
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  char buf[LARGE];
+  void *ptr;
+  int32_t size;
+  int seq, ret;
+
+  init = coroc_coroutine_self();
+  coroc_coroutine_spawn(producer, NULL, "producer");
+
+  for (seq = 0; seq < NUM; seq++) {
+    if (seq % 2 == 0) {
+      // the received buffer is owned by the receiver ..
+      ret = coroc_recvp(&ptr, &size, true);
+      CHECK(ret == CHAN_SUCCESS || ret == CHAN_AWAKEN);
+      msg_check(ptr, size, seq);
+      free(ptr);
+    } else {
+      ret = coroc_recv(buf, sizeof(buf), true);
+      CHECK(ret == CHAN_SUCCESS || ret == CHAN_AWAKEN);
+      msg_check(buf, msg_size(seq), seq);
+    }
+  }
+
+  ret = coroc_recv(buf, sizeof(buf), false);
+  CHECK(ret == CHAN_BUSY);
+  printf("received all the %d messages in order.\n", NUM);
+  coroc_coroutine_exit(0);
+}
@@ -0,0 +1,107 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define NUM 100
+
+// a buffer passed by its handle, never copied ..
+typedef struct buffer {
+  struct coroc_refcnt refcnt;
+  int seq;
+  char data[4096];
+} *buffer_t;
+
+coroc_coroutine_t init;
+static int released = 0;
+
+static void buffer_release(buffer_t buf) {
+  __sync_add_and_fetch(&released, 1);
+  free(buf);
+}
+
+static buffer_t buffer_alloc(int seq) {
+  buffer_t buf = malloc(sizeof(struct buffer));
+  coroc_refcnt_init(&buf->refcnt, (release_handler_t)buffer_release);
+  buf->seq = seq;
+  snprintf(buf->data, sizeof(buf->data), "buffer #%d", seq);
+  return buf;
+}
+
+int consumer(coroc_chan_t chan) {
+  buffer_t buf;
+  char expect[32];
+  int seq = 0;
+
+  while (coroc_chan_recv(chan, &buf) != CHAN_CLOSED) {
+    // the receiver owns the handle now ..
+    snprintf(expect, sizeof(expect), "buffer #%d", seq);
+    CHECK(buf->seq == seq && strcmp(buf->data, expect) == 0);
+    coroc_refcnt_put((coroc_refcnt_t)buf);
+    seq++;
+  }
+
+  CHECK(seq == NUM);
+  printf("[consumer] received %d buffers.\n", seq);
+  coroc_sendp(init, NULL, 0);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+  coroc_coroutine_exit(0);
+}
+
+int main(int argc, char** argv) {
+  int i, ret;
+  buffer_t buf;
+  coroc_chan_t chan = coroc_move_chan_allocate(4);
+
+  init = coroc_coroutine_self();
+  coroc_coroutine_allocate((coroc_coroutine_handler_t)consumer,
+                           coroc_refcnt_get(chan), "consumer",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, 0);
+
+  for (i = 0; i < NUM; i++) {
+    buf = buffer_alloc(i);
+    coroc_chan_send(chan, &buf);
+    // the sender's handle is reset once it is moved ..
+    CHECK(buf == NULL);
+  }
+
+  // wait until the consumer has released all of them, since the closing
+  // releases the handles still in the buffer ..
+  while (__sync_add_and_fetch(&released, 0) < NUM) coroc_coroutine_yield();
+  coroc_chan_close(chan);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+  coroc_recv(NULL, 0, true);
+
+  // a failed send keeps the handle with the sender ..
+  chan = coroc_move_chan_allocate(0);
+  buf = buffer_alloc(NUM);
+  ret = coroc_chan_nbsend(chan, &buf);
+  CHECK(ret == CHAN_BUSY && buf != NULL);
+  coroc_refcnt_put((coroc_refcnt_t)buf);
+  CHECK(released == NUM + 1);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+
+  // receiving into NULL drops the handle,
+  // and the ones left in the buffer are released by the closing ..
+  chan = coroc_move_chan_allocate(8);
+  for (i = 0; i < 5; i++) {
+    buf = buffer_alloc(i);
+    ret = coroc_chan_nbsend(chan, &buf);
+    CHECK(ret == CHAN_SUCCESS && buf == NULL);
+  }
+  ret = coroc_chan_nbrecv(chan, NULL);
+  CHECK(ret == CHAN_SUCCESS);
+  CHECK(released == NUM + 2);
+  coroc_chan_close(chan);
+  CHECK(released == NUM + 6);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+
+  printf("all %d buffers are released.\n", released);
+  coroc_coroutine_exit(0);
+}
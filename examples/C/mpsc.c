@@ -0,0 +1,60 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define PRODUCERS 8
+#define NUM 50000
+
+coroc_coroutine_t init;
+
+typedef struct message {
+  long id;
+  long seq;
+} message_t;
+
+// many producers push into the same mailbox concurrently ..
+int producer(void *arg) {
+  message_t msg = {(long)arg, 0};
+
+  for (; msg.seq < NUM; msg.seq++) {
+    coroc_send(init, &msg, sizeof(msg));
+    if (msg.seq % 4096 == 0) coroc_coroutine_yield();
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  long i, n, last[PRODUCERS];
+  int ret;
+  message_t msg;
+
+  init = coroc_coroutine_self();
+  for (i = 0; i < PRODUCERS; i++) {
+    last[i] = -1;
+    coroc_coroutine_spawn(producer, (void *)i, "producer");
+  }
+
+  // only the owner pops the mailbox, the messages of each producer
+  // are received in the sending order ..
+  for (n = 0; n < PRODUCERS * NUM; n++) {
+    ret = coroc_recv(&msg, sizeof(msg), true);
+    CHECK(ret == CHAN_SUCCESS || ret == CHAN_AWAKEN);
+    CHECK(msg.id >= 0 && msg.id < PRODUCERS);
+    CHECK(msg.seq == last[msg.id] + 1);
+    last[msg.id] = msg.seq;
+  }
+
+  for (i = 0; i < PRODUCERS; i++) CHECK(last[i] == NUM - 1);
+  ret = coroc_recv(&msg, sizeof(msg), false);
+  CHECK(ret == CHAN_BUSY);
+
+  printf("received %ld messages from %d producers.\n", n, PRODUCERS);
+  coroc_coroutine_exit(0);
+}
@@ -0,0 +1,79 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define BUFSIZE 16
+#define NUM 1000
+
+typedef struct job {
+  int level;  // the higher level runs first
+  int seq;
+} job_t;
+
+static int64_t job_priority(const void *job) {
+  return ((const job_t *)job)->level;
+}
+
+int producer(coroc_chan_t chan) {
+  int i;
+
+  for (i = 0; i < NUM; i++) {
+    job_t job = {i % 5, i};
+    coroc_chan_send(chan, &job);
+  }
+
+  coroc_chan_close(chan);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+  coroc_coroutine_exit(0);
+}
+
+int main(int argc, char** argv) {
+  int i, n = 0, sum = 0, ret;
+  job_t job, last = {BUFSIZE, -1};
+  coroc_chan_t chan =
+      coroc_prio_chan_allocate(sizeof(job_t), BUFSIZE, job_priority);
+
+  // fill the buffer, the one more is refused ..
+  for (i = 0; i < BUFSIZE; i++) {
+    job.level = i % 3;
+    job.seq = i;
+    ret = coroc_chan_nbsend(chan, &job);
+    CHECK(ret == CHAN_SUCCESS);
+  }
+  ret = coroc_chan_nbsend(chan, &job);
+  CHECK(ret == CHAN_BUSY);
+
+  // received by the level, then in the sending order of the same level ..
+  for (i = 0; i < BUFSIZE; i++) {
+    ret = coroc_chan_nbrecv(chan, &job);
+    CHECK(ret == CHAN_SUCCESS);
+    CHECK(job.level < last.level ||
+          (job.level == last.level && job.seq > last.seq));
+    printf("%d:%d ", job.level, job.seq);
+    last = job;
+  }
+  printf("\n");
+  ret = coroc_chan_nbrecv(chan, &job);
+  CHECK(ret == CHAN_BUSY);
+
+  // the blocked sender, every job is received once ..
+  coroc_coroutine_allocate((coroc_coroutine_handler_t)producer,
+                           coroc_refcnt_get(chan), "producer",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, 0);
+  while (coroc_chan_recv(chan, &job) != CHAN_CLOSED) {
+    CHECK(job.level == job.seq % 5);
+    sum += job.seq;
+    n++;
+  }
+  CHECK(n == NUM && sum == NUM * (NUM - 1) / 2);
+  printf("received all the %d jobs.\n", n);
+
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+  coroc_coroutine_exit(0);
+}
@@ -0,0 +1,162 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "libcoroc.h"
+
+// a stub DNS server on the local port, the resolver is pointed to it,
+// and the lookups show the cache, the coalescing and the TCP fallback ..
+
+#define PORT 10053
+#define LOOKUPS 100
+
+int queries = 0;  // the queries got by the stub
+coroc_group_t group;
+
+// answer the query in `msg', the `big.test' is truncated over UDP ..
+int answer(uint8_t *msg, int len, bool udp) {
+  char name[256] = "";
+  int off = 12, n = 0, ancount = 1;
+
+  __sync_add_and_fetch(&queries, 1);
+
+  while (off < len && msg[off] != 0) {
+    if (n > 0) name[n++] = '.';
+    memcpy(name + n, msg + off + 1, msg[off]);
+    n += msg[off];
+    off += msg[off] + 1;
+  }
+  name[n] = '\0';
+  off += 5;  // the root, type and class
+
+  msg[2] |= 0x80;  // a response
+  msg[3] = 0;
+  if (strcmp(name, "none.test") == 0) {
+    msg[3] = 3;  // no such name
+    ancount = 0;
+  } else if (udp && strcmp(name, "big.test") == 0) {
+    msg[2] |= 0x02;  // truncated
+    ancount = 0;
+  }
+
+  msg[6] = 0, msg[7] = ancount;
+  if (ancount == 0) return off;
+
+  // the name pointer, A, IN, TTL 2s and the address ..
+  uint8_t rr[] = {0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 2, 0, 4, 10, 0, 0, 1};
+  if (strcmp(name, "big.test") == 0) rr[15] = 2;
+  memcpy(msg + off, rr, sizeof(rr));
+
+  // slow enough to have all the lookups coalesced ..
+  coroc_udelay(10000);
+  return off + sizeof(rr);
+}
+
+int udp_server(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  uint8_t buf[512];
+  struct sockaddr_in sa;
+  struct iovec iov;
+  struct msghdr msg;
+  ssize_t n;
+
+  for (;;) {
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    msg.msg_name = &sa;
+    msg.msg_namelen = sizeof(sa);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if ((n = coroc_net_recvmsg(fd, &msg, 0)) <= 0) continue;
+
+    iov.iov_len = answer(buf, n, true);
+    coroc_net_sendmsg(fd, &msg, 0);
+  }
+}
+
+int tcp_server(void *arg) {
+  int fd = (int)(intptr_t)arg, cfd, len;
+  uint8_t buf[514];
+
+  while ((cfd = coroc_net_accept(fd, NULL, NULL)) >= 0) {
+    if (coroc_net_timed_read(cfd, buf, sizeof(buf), 0) > 2) {
+      len = answer(buf + 2, (buf[0] << 8) | buf[1], false);
+      buf[0] = len >> 8;
+      buf[1] = len & 0xff;
+      coroc_net_write(cfd, buf, len + 2);
+    }
+    coroc_net_close(cfd);
+  }
+
+  coroc_coroutine_exit(0);
+}
+
+int lookup(void *arg) {
+  uint32_t ip;
+
+  if (coroc_dns_lookup((const char *)arg, &ip) < 0)
+    fprintf(stderr, "lookup %s: %s\n", (const char *)arg, strerror(errno));
+  coroc_group_notify(group, 0);
+  coroc_coroutine_exit(0);
+}
+
+void show(const char *name) {
+  char buf[INET_ADDRSTRLEN];
+  uint32_t ip;
+  int before = queries;
+  uint64_t start = coroc_getmicrotime();
+
+  if (coroc_dns_lookup(name, &ip) < 0)
+    printf("%s: %s", name, strerror(errno));
+  else
+    printf("%s: %s", name, inet_ntop(AF_INET, &ip, buf, sizeof(buf)));
+
+  printf(", %d queries in %lu us\n", queries - before,
+         (unsigned long)(coroc_getmicrotime() - start));
+}
+
+int main(int argc, char **argv) {
+  int ufd, tfd, i;
+
+  if ((ufd = coroc_net_announce(false, "127.0.0.1", PORT)) < 0 ||
+      (tfd = coroc_net_announce(true, "127.0.0.1", PORT)) < 0) {
+    fprintf(stderr, "cannot announce on port %d: %s\n", PORT, strerror(errno));
+    coroc_coroutine_exit(-1);
+  }
+
+  coroc_coroutine_allocate(udp_server, (void *)(intptr_t)ufd, "udp",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
+  coroc_coroutine_allocate(tcp_server, (void *)(intptr_t)tfd, "tcp",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
+  coroc_dns_set_server("127.0.0.1", PORT);
+
+  // the concurrent lookups of one name share a query ..
+  group = coroc_group_alloc();
+  for (i = 0; i < LOOKUPS; i++) {
+    coroc_group_add_task(group);
+    coroc_coroutine_allocate(lookup, "a.test", "lookup", TSC_COROUTINE_NORMAL,
+                             TSC_DEFAULT_PRIO, NULL);
+  }
+  coroc_group_sync(group);
+  printf("%d lookups of a.test, %d queries\n", LOOKUPS, queries);
+
+  show("a.test");     // cached
+  show("big.test");   // truncated, then by TCP
+  show("none.test");  // no such name
+  show("none.test");  // cached too
+
+  coroc_udelay(2100000);
+  show("a.test");  // expired
+
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define REQUESTS 3000
+#define EVENTS 20000
+
+coroc_coroutine_t init;
+
+static inline bool succeeded(int ret) {
+  return ret == CHAN_SUCCESS || ret == CHAN_AWAKEN;
+}
+
+// reply each request with the tag of its id, a negative id stops it ..
+int server(void *arg) {
+  long id, reply;
+
+  while (succeeded(coroc_recv(&id, sizeof(id), true)) && id >= 0) {
+    reply = id * 3;
+    coroc_send_tagged(init, (uint64_t)id + 1, &reply, sizeof(reply));
+  }
+
+  return 0;
+}
+
+// the untagged messages mixed with the replies ..
+int notifier(void *arg) {
+  long seq;
+
+  for (seq = 0; seq < EVENTS; seq++) {
+    coroc_send(init, &seq, sizeof(seq));
+    if (seq % 500 == 0) coroc_coroutine_yield();
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  long i, first, second, reply, event, next = 0;
+  int ret;
+  coroc_coroutine_t srv;
+
+  init = coroc_coroutine_self();
+  srv = coroc_coroutine_spawn(server, NULL, "server");
+  coroc_coroutine_spawn(notifier, NULL, "notifier");
+
+  for (i = 0; i < REQUESTS; i++) {
+    // two requests in flight, wait for the second reply first ..
+    first = i;
+    second = i + REQUESTS;
+    coroc_send(srv, &first, sizeof(first));
+    coroc_send(srv, &second, sizeof(second));
+
+    ret = coroc_recv_tagged(second + 1, &reply, sizeof(reply), true);
+    CHECK(succeeded(ret) && reply == second * 3);
+    ret = coroc_recv_tagged(first + 1, &reply, sizeof(reply), true);
+    CHECK(succeeded(ret) && reply == first * 3);
+
+    // no such a reply ..
+    ret = coroc_recv_tagged(REQUESTS * 3, &reply, sizeof(reply), false);
+    CHECK(ret == CHAN_BUSY);
+
+    // the skipped untagged ones are kept in order ..
+    if (i % 3 == 0 && next < EVENTS) {
+      ret = coroc_recv(&event, sizeof(event), true);
+      CHECK(succeeded(ret) && event == next);
+      next++;
+    }
+  }
+
+  while (next < EVENTS) {
+    ret = coroc_recv(&event, sizeof(event), true);
+    CHECK(succeeded(ret) && event == next);
+    next++;
+  }
+  ret = coroc_recv(&event, sizeof(event), false);
+  CHECK(ret == CHAN_BUSY);
+
+  i = -1;
+  coroc_send(srv, &i, sizeof(i));
+
+  printf("%d replies and %d events are received.\n", REQUESTS * 2, EVENTS);
+  coroc_coroutine_exit(0);
+}
@@ -11,50 +11,87 @@
 
 #include "libcoroc.h"
 
+// the bytes moved by each call of both modes ..
+#define CHUNK (256 * 1024)
+
 char *server;
 int port;
+bool copy = false;  // read / write through a user buffer instead of splice
+int accept_task(void *);
 int proxy_task(void *);
 int rwtask(void *);
 
-int *mkfd2(int fd1, int fd2) {
-  int *a;
-
-  a = malloc(2 * sizeof a[0]);
-  if (a == 0) {
+// one proxied connection, both of its fds are closed
+// by the last direction finished ..
+typedef struct conn {
+  struct half {
+    struct conn *conn;
+    int rfd, wfd;
+  } half[2];
+  int running;
+} conn_t;
+
+conn_t *mkconn(int fd1, int fd2) {
+  conn_t *c;
+
+  c = malloc(sizeof *c);
+  if (c == 0) {
     fprintf(stderr, "out of memory\n");
     abort();
   }
 
-  a[0] = fd1;
-  a[1] = fd2;
+  c->half[0].conn = c->half[1].conn = c;
+  c->half[0].rfd = c->half[1].wfd = fd1;
+  c->half[0].wfd = c->half[1].rfd = fd2;
+  c->running = 2;
 
-  return a;
+  return c;
 }
 
 int main(int argc, char **argv) {
-  int cfd, fd;
-  int rport;
-  char remote[16];
+  coroc_net_listeners_t ls;
+  int i;
+
+  if (argc == 5 && strcmp(argv[1], "-copy") == 0) {
+    copy = true;
+    argc--;
+    argv++;
+  }
 
   if (argc != 4) {
-    fprintf(stderr, "usage: tcpproxy localport server remoteport\n");
+    fprintf(stderr, "usage: tcpproxy [-copy] localport server remoteport\n");
     coroc_coroutine_exit(-1);
   }
 
   server = argv[2];
   port = atoi(argv[3]);
 
-  if ((fd = coroc_net_announce(true, 0, atoi(argv[1]))) < 0) {
+  // one listener per VPU, each of them has its own acceptor ..
+  if ((ls = coroc_net_announce_listeners(0, atoi(argv[1]), SOMAXCONN)) ==
+      NULL) {
     fprintf(stderr, "cannot announce on tcp port %d: %s\n", atoi(argv[1]),
             strerror(errno));
     coroc_coroutine_exit(-1);
   }
 
-  coroc_net_nonblock(fd);
-  while ((cfd = coroc_net_accept(fd, remote, &rport)) >= 0) {
-    fprintf(stderr, "connection from %s:%d\n", remote, rport);
-    coroc_coroutine_allocate(proxy_task, (void*)cfd, "proxy",
-                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
+  for (i = 1; i < ls->num; i++)
+    coroc_coroutine_allocate(accept_task, (void *)(intptr_t)ls->fds[i],
+                             "accept", TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO,
+                             NULL);
+
+  // the main one takes the first listener ..
+  return accept_task((void *)(intptr_t)ls->fds[0]);
+}
+
+int accept_task(void *v) {
+  int fd, cfds[16], i, n;
+
+  fd = (int)(intptr_t)v;
+  while ((n = coroc_net_accept_many(fd, cfds, 16)) > 0) {
+    fprintf(stderr, "%d connections on listener %d\n", n, fd);
+    for (i = 0; i < n; i++)
+      coroc_coroutine_allocate(proxy_task, (void *)(intptr_t)cfds[i], "proxy",
+                               TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
   }
 
   coroc_coroutine_exit(0);
@@ -62,37 +99,57 @@ int main(int argc, char **argv) {
 
 int proxy_task(void *v) {
   int fd, remotefd;
+  conn_t *c;
 
-  fd = (int)v;
+  fd = (int)(intptr_t)v;
   if ((remotefd = coroc_net_dial(true, server, port)) < 0) {
-    close(fd);
+    coroc_net_close(fd);
     coroc_coroutine_exit(-1);
   }
 
   fprintf(stderr, "connected to %s:%d\n", server, port);
 
-  coroc_coroutine_allocate(rwtask, mkfd2(fd, remotefd), "rwtask",
-                         TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
-  coroc_coroutine_allocate(rwtask, mkfd2(remotefd, fd), "rwtask",
-                         TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
+  c = mkconn(fd, remotefd);
+  coroc_coroutine_allocate(rwtask, &c->half[0], "rwtask",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
+  coroc_coroutine_allocate(rwtask, &c->half[1], "rwtask",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, NULL);
 
   coroc_coroutine_exit(0);
 }
 
+// forward one direction until EOF, and report its throughput ..
 int rwtask(void *v) {
-  int *a, rfd, wfd, n;
-  char buf[2048];
-
-  a = v;
-  rfd = a[0];
-  wfd = a[1];
-  free(a);
+  struct half *h = v;
+  int rfd = h->rfd, wfd = h->wfd;
+  ssize_t n, total = 0;
+  int64_t start, usec;
+  char *buf;
+
+  start = coroc_getmicrotime();
+  if (copy) {
+    buf = malloc(CHUNK);
+    while ((n = coroc_net_timed_read(rfd, buf, CHUNK, 0)) > 0 &&
+           coroc_net_write(wfd, buf, n) == n)
+      total += n;
+    free(buf);
+  } else {
+    // the data never goes through the user space ..
+    while ((n = coroc_net_splice(rfd, wfd, CHUNK)) > 0) total += n;
+  }
+  usec = coroc_getmicrotime() - start;
 
-  while ((n = coroc_net_read(rfd, buf, sizeof buf)) > 0)
-    coroc_net_write(wfd, buf, n);
+  fprintf(stderr, "%d -> %d: %ld bytes in %.3f s, %.1f MB/s\n", rfd, wfd,
+          (long)total, usec / 1e6,
+          (usec > 0) ? total / (double)usec : 0.0);
 
+  // the other direction may be still writing to the `rfd' ..
   shutdown(wfd, SHUT_WR);
-  close(rfd);
+  if (__sync_sub_and_fetch(&h->conn->running, 1) == 0) {
+    coroc_net_close(rfd);
+    coroc_net_close(wfd);
+    free(h->conn);
+  }
 
   coroc_coroutine_exit(0);
 }
@@ -0,0 +1,95 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define TIMEOUT 20000  // 20ms
+#define DELAY 5000     // 5ms
+
+coroc_chan_t chan, chan2;
+
+// send a value to `chan2' after a while ..
+int sender(void *arg) {
+  int value = 42;
+  coroc_udelay(DELAY);
+  coroc_chan_send(chan2, &value);
+  return 0;
+}
+
+// close the `chan' after a while ..
+int closer(void *arg) {
+  coroc_udelay(DELAY);
+  coroc_chan_close(chan);
+  return 0;
+}
+
+static inline bool succeeded(int ret) {
+  return ret == CHAN_SUCCESS || ret == CHAN_AWAKEN;
+}
+
+int main(int argc, char** argv) {
+  int value = 0, ret;
+  uint64_t start;
+  coroc_chan_t active;
+  coroc_chan_set_t set;
+
+  chan = coroc_chan_allocate(sizeof(int), 0);
+  chan2 = coroc_chan_allocate(sizeof(int), 0);
+
+  // no one sends or receives, both time out after the deadline,
+  // which is counted from the cached time ..
+  start = coroc_getcachedtime();
+  ret = coroc_chan_recv_timeout(chan, &value, TIMEOUT);
+  CHECK(ret == CHAN_TIMEOUT);
+  CHECK(coroc_getmicrotime() - start >= TIMEOUT);
+  printf("recv timed out after %llu us.\n",
+         (unsigned long long)(coroc_getmicrotime() - start));
+
+  start = coroc_getcachedtime();
+  ret = coroc_chan_send_timeout(chan, &value, TIMEOUT);
+  CHECK(ret == CHAN_TIMEOUT);
+  CHECK(coroc_getmicrotime() - start >= TIMEOUT);
+  printf("send timed out after %llu us.\n",
+         (unsigned long long)(coroc_getmicrotime() - start));
+
+  set = coroc_chan_set_allocate(2);
+  coroc_chan_set_recv(set, chan, &value);
+  coroc_chan_set_recv(set, chan2, &value);
+
+  start = coroc_getcachedtime();
+  ret = coroc_chan_set_timedselect(set, TIMEOUT, &active);
+  CHECK(ret == CHAN_TIMEOUT && active == NULL);
+  CHECK(coroc_getmicrotime() - start >= TIMEOUT);
+  printf("select timed out after %llu us.\n",
+         (unsigned long long)(coroc_getmicrotime() - start));
+
+  // the value comes before the deadline ..
+  coroc_coroutine_spawn(sender, NULL, "sender");
+  ret = coroc_chan_set_timedselect(set, 1000000, &active);
+  CHECK(succeeded(ret) && active == chan2 && value == 42);
+  printf("select got %d from the second channel.\n", value);
+  coroc_chan_set_dealloc(set);
+
+  value = 0;
+  coroc_coroutine_spawn(sender, NULL, "sender");
+  ret = coroc_chan_recv_timeout(chan2, &value, 1000000);
+  CHECK(succeeded(ret) && value == 42);
+  printf("recv got %d before the deadline.\n", value);
+
+  // the waiter is woken up by the closing ..
+  start = coroc_getcachedtime();
+  coroc_coroutine_spawn(closer, NULL, "closer");
+  ret = coroc_chan_recv_timeout(chan, &value, 1000000);
+  CHECK(ret == CHAN_CLOSED);
+  CHECK(coroc_getmicrotime() - start < 1000000);
+  printf("recv returned on the closing.\n");
+
+  coroc_chan_dealloc(chan);
+  coroc_chan_dealloc(chan2);
+  coroc_coroutine_exit(0);
+}
@@ -0,0 +1,89 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+
+// build it with and without the `ENABLE_TIMER_WHEEL' to compare
+// the timing wheel with the binary heap ..
+
+#define SLEEPERS 1000
+#define SLEEP_ROUNDS 100
+
+coroc_group_t group;
+uint64_t late_total = 0;
+
+int sleeper(void* arg) {
+  unsigned seed = (unsigned)(uintptr_t)arg;
+  uint64_t late = 0;
+  int i;
+
+  for (i = 0; i < SLEEP_ROUNDS; i++) {
+    uint64_t us = 100 + rand_r(&seed) % 2000;
+    uint64_t start = coroc_getmicrotime();
+    coroc_udelay(us);
+    late += coroc_getmicrotime() - start - us;
+  }
+
+  __sync_add_and_fetch(&late_total, late);
+  coroc_group_notify(group, 0);
+  coroc_coroutine_exit(0);
+}
+
+static double elapsed(uint64_t start, int n) {
+  return 1000.0 * (coroc_getmicrotime() - start) / n;
+}
+
+int main(int argc, char** argv) {
+  int ntimers = argc > 1 ? atoi(argv[1]) : 100000;
+  int nops = argc > 2 ? atoi(argv[2]) : 1000000;
+  coroc_timer_t* timers = malloc(ntimers * sizeof(coroc_timer_t));
+  unsigned seed = 1;
+  uint64_t start;
+  int i;
+
+  for (i = 0; i < ntimers; i++) timers[i] = coroc_timer_allocate(0, NULL);
+
+  // the far deadlines, like the idle timeouts of the connections ..
+  start = coroc_getmicrotime();
+  for (i = 0; i < ntimers; i++)
+    coroc_timer_after(timers[i], 1000000 + rand_r(&seed) % 60000000);
+  printf("insert: %.1f ns/op with %d timers\n", elapsed(start, ntimers),
+         ntimers);
+
+  // push the deadlines back, like a successful I/O does ..
+  start = coroc_getmicrotime();
+  for (i = 0; i < nops; i++) {
+    coroc_timer_t t = timers[rand_r(&seed) % ntimers];
+    coroc_timer_reset(t, coroc_getmicrotime() + 1000000 +
+                             rand_r(&seed) % 60000000);
+  }
+  printf("reset: %.1f ns/op\n", elapsed(start, nops));
+
+  start = coroc_getmicrotime();
+  for (i = 0; i < ntimers; i++) coroc_timer_stop(timers[i]);
+  printf("cancel: %.1f ns/op\n", elapsed(start, ntimers));
+
+  for (i = 0; i < ntimers; i++) coroc_timer_dealloc(timers[i]);
+  free(timers);
+
+  // the short sleeps expired by the VPU schedulers ..
+  group = coroc_group_alloc();
+  start = coroc_getmicrotime();
+  // count all the sleepers first, the early ones may finish
+  // before the last one is spawned ..
+  for (i = 0; i < SLEEPERS; i++) coroc_group_add_task(group);
+  for (i = 0; i < SLEEPERS; i++)
+    coroc_coroutine_spawn(sleeper, (uintptr_t)(i + 1), "sleeper");
+  coroc_group_sync(group);
+  free(group);
+
+  printf("expire: %d sleeps in %.1f ms, %.1f us late on average\n",
+         SLEEPERS * SLEEP_ROUNDS, (coroc_getmicrotime() - start) / 1000.0,
+         (double)late_total / (SLEEPERS * SLEEP_ROUNDS));
+
+  coroc_coroutine_exit(0);
+}
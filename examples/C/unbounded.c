@@ -0,0 +1,95 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libcoroc.h"
+#include "check.h"
+
+#define NUM 100000
+#define WATERMARK 10000
+
+coroc_coroutine_t init;
+static int64_t backlog = 0;
+static int notified = 0;
+
+// called with the channel's lock held, just record it ..
+static void watermark(coroc_chan_t chan, int64_t n) {
+  backlog = n;
+  notified++;
+}
+
+int consumer(coroc_chan_t chan) {
+  long v, n = 0;
+
+  // the elements are received in order, even after the closing ..
+  while (coroc_chan_recv(chan, &v) != CHAN_CLOSED) {
+    CHECK(v == n);
+    n++;
+  }
+
+  printf("[consumer] received %ld elements.\n", n);
+  coroc_send(init, &n, sizeof(n));
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+  coroc_coroutine_exit(0);
+}
+
+static int released = 0;
+
+static void handle_release(coroc_refcnt_t ref) {
+  released++;
+  free(ref);
+}
+
+int main(int argc, char** argv) {
+  long i, n = 0;
+  int ret;
+  coroc_chan_t chan = coroc_unbounded_chan_allocate(sizeof(long));
+
+  init = coroc_coroutine_self();
+  coroc_chan_set_watermark(chan, WATERMARK, watermark);
+
+  // the sends never block, the buffer just grows ..
+  for (i = 0; i < NUM; i++) {
+    ret = coroc_chan_nbsend(chan, &i);
+    CHECK(ret == CHAN_SUCCESS);
+  }
+  CHECK(notified == 1 && backlog > WATERMARK);
+  printf("the watermark is hit with %lld buffered.\n", (long long)backlog);
+
+  coroc_coroutine_allocate((coroc_coroutine_handler_t)consumer,
+                           coroc_refcnt_get(chan), "consumer",
+                           TSC_COROUTINE_NORMAL, TSC_DEFAULT_PRIO, 0);
+  coroc_chan_close(chan);
+  coroc_recv(&n, sizeof(n), true);
+  CHECK(n == NUM);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+
+  // an unbounded move channel, the handles received into NULL are dropped ..
+  chan = coroc_move_chan_allocate(-1);
+  for (i = 0; i < 3; i++) {
+    coroc_refcnt_t ref = malloc(sizeof(struct coroc_refcnt));
+    coroc_refcnt_init(ref, (release_handler_t)handle_release);
+    coroc_chan_send(chan, &ref);
+    CHECK(ref == NULL);
+  }
+  ret = coroc_chan_recv(chan, NULL);
+  CHECK(ret == CHAN_SUCCESS);
+  CHECK(released == 1);
+
+  coroc_refcnt_t ref = NULL;
+  ret = coroc_chan_recv(chan, &ref);
+  CHECK(ret == CHAN_SUCCESS && ref != NULL);
+  coroc_refcnt_put(ref);
+  CHECK(released == 2);
+
+  // and the last one is released by the closing ..
+  coroc_chan_close(chan);
+  CHECK(released == 3);
+  coroc_refcnt_put((coroc_refcnt_t)chan);
+
+  printf("all the handles are released.\n");
+  coroc_coroutine_exit(0);
+}
@@ -0,0 +1,62 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#ifndef _TSC_CORE_BROADCAST_H_
+#define _TSC_CORE_BROADCAST_H_
+
+#include <stdint.h>
+#include "support.h"
+#include "channel.h"
+
+// the policies for the slow subscribers when the ring is full:
+//  BLOCK     -- the publisher waits until the slowest one catches up,
+//  DROP      -- the new element is dropped and the publisher gets CHAN_BUSY,
+//  OVERWRITE -- the oldest element is overwritten, the slow subscribers
+//               skip the lost elements and record them as `lagged'.
+enum {
+  TSC_BCAST_BLOCK = 0,
+  TSC_BCAST_DROP = 1,
+  TSC_BCAST_OVERWRITE = 2,
+};
+
+// the broadcast channel, all the subscribers share one ring buffer
+// and each of them has its own cursor, so every element is copied
+// only once by the publisher ..
+typedef struct coroc_bcast_chan {
+  struct coroc_chan _chan;
+  int32_t policy;
+  int32_t bufsize;
+  uint64_t head;    // the sequence of the next element to publish
+  uint64_t tail;    // the min cursor of all subscribers
+  uint32_t ntail;   // the number of subscribers staying at the tail
+  uint64_t dropped; // the elements dropped by the DROP policy
+  queue_t subs;
+  uint8_t *buf;
+} *coroc_bcast_t;
+
+typedef struct coroc_bcast_sub {
+  coroc_bcast_t bcast;
+  uint64_t cursor;  // the sequence of the next element to receive
+  uint64_t lagged;  // the elements overwritten before being received
+  queue_item_t link;
+} *coroc_bcast_sub_t;
+
+coroc_bcast_t coroc_bcast_allocate(int32_t elemsize, int32_t bufsize,
+                                   int policy);
+void coroc_bcast_dealloc(coroc_bcast_t bcast);
+int coroc_bcast_close(coroc_bcast_t bcast);
+
+// the new subscriber only receives the elements published after it joins.
+coroc_bcast_sub_t coroc_bcast_subscribe(coroc_bcast_t bcast);
+void coroc_bcast_unsubscribe(coroc_bcast_sub_t sub);
+
+extern int _coroc_bcast_publish(coroc_bcast_t bcast, void *buf, bool block);
+extern int _coroc_bcast_recv(coroc_bcast_sub_t sub, void *buf, bool block);
+
+#define coroc_bcast_publish(bcast, buf) _coroc_bcast_publish(bcast, buf, true)
+#define coroc_bcast_nbpublish(bcast, buf) _coroc_bcast_publish(bcast, buf, false)
+#define coroc_bcast_recv(sub, buf) _coroc_bcast_recv(sub, buf, true)
+#define coroc_bcast_nbrecv(sub, buf) _coroc_bcast_recv(sub, buf, false)
+
+#endif  // _TSC_CORE_BROADCAST_H_
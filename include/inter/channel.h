@@ -12,10 +12,18 @@
 #include "coroc_queue.h"
 #include "lock_chain.h"
 
-enum { CHAN_SUCCESS = 0, CHAN_AWAKEN = 1, CHAN_BUSY = 2, CHAN_CLOSED = 4, };
+enum {
+  CHAN_SUCCESS = 0,
+  CHAN_AWAKEN = 1,
+  CHAN_BUSY = 2,
+  CHAN_CLOSED = 4,
+  CHAN_TIMEOUT = 8,
+};
 
 struct coroc_chan;
 typedef bool (*coroc_chan_handler)(struct coroc_chan *, void *);
+typedef void (*coroc_chan_fini_handler)(struct coroc_chan *);
+typedef void (*coroc_chan_copy_handler)(struct coroc_chan *, void *, void *);
 
 // the general channel type ..
 typedef struct coroc_chan {
@@ -24,11 +32,15 @@ typedef struct coroc_chan {
   bool select;
   coroc_lock lock;
   int32_t isref:1;
-  int32_t elemsize:31;
+  int32_t ismove:1;
+  int32_t isasync:1;  // the senders push into the buffer without the lock
+  int32_t elemsize:29;
   queue_t recv_que;
   queue_t send_que;
   coroc_chan_handler copy_to_buff;
   coroc_chan_handler copy_from_buff;
+  coroc_chan_fini_handler fini;  // release the buffer when dealloc
+  coroc_chan_copy_handler copy;  // pass one element from sender to receiver
 } *coroc_chan_t;
 
 // the buffered channel ..
@@ -51,9 +63,13 @@ static inline void coroc_chan_init(coroc_chan_t ch, int32_t elemsize, bool isref
   ch->close = false;
   ch->select = false;
   ch->isref = isref ? 1 : 0;
+  ch->ismove = 0;
+  ch->isasync = 0;
   ch->elemsize = elemsize;
   ch->copy_to_buff = to;
   ch->copy_from_buff = from;
+  ch->fini = NULL;
+  ch->copy = NULL;
 
   lock_init(&ch->lock);
   queue_init(&ch->recv_que);
@@ -62,6 +78,9 @@ static inline void coroc_chan_init(coroc_chan_t ch, int32_t elemsize, bool isref
 
 extern bool __coroc_copy_to_buff(coroc_chan_t, void *);
 extern bool __coroc_copy_from_buff(coroc_chan_t, void *);
+// pass one element in the buffer to a blocked receiver,
+// must hold the lock and the buffer must not be empty ..
+extern bool __coroc_chan_wakeup_recv(coroc_chan_t);
 
 // init the buffered channel ..
 static inline void coroc_buffered_chan_init(coroc_buffered_chan_t ch,
@@ -76,10 +95,78 @@ static inline void coroc_buffered_chan_init(coroc_buffered_chan_t ch,
   ch->recvx = ch->sendx = 0;
 }
 
+// the segment of the unbounded channel,
+// the segments are allocated from the per-VPU slab caches.
+typedef struct coroc_chan_seg {
+  struct coroc_chan_seg *next;
+  int32_t recvx;
+  int32_t sendx;
+  uint8_t buf[0];
+} coroc_chan_seg_t;
+
+#define TSC_CHAN_SEG_BYTES 4096
+
+typedef void (*coroc_chan_watermark_t)(struct coroc_chan *, int64_t);
+
+// the unbounded channel, the buffer grows and shrinks
+// by linking and unlinking the fixed size segments ..
+typedef struct coroc_unbounded_chan {
+  struct coroc_chan _chan;
+  int32_t segsize;  // elements per segment
+  bool overflow;
+  int64_t nbuf;
+  int64_t watermark;
+  coroc_chan_watermark_t notify;
+  coroc_chan_seg_t *head;
+  coroc_chan_seg_t *tail;
+} *coroc_unbounded_chan_t;
+
+// the priority of an element, higher value is received first.
+typedef int64_t (*coroc_chan_prio_fn)(const void *);
+
+typedef struct coroc_prio_entry {
+  int64_t prio;
+  uint64_t seq;  // keep the FIFO order for the same priority
+  int32_t slot;
+} coroc_prio_entry_t;
+
+// the priority channel, the buffer is a binary heap
+// ordered by the priority given by the user's `prio' callback ..
+typedef struct coroc_prio_chan {
+  struct coroc_chan _chan;
+  int32_t bufsize;
+  int32_t nbuf;
+  uint64_t seq;
+  coroc_chan_prio_fn prio;
+  coroc_prio_entry_t *heap;
+  int32_t *slots;  // the free slots in the `buf'
+  uint8_t *buf;
+} *coroc_prio_chan_t;
+
+// a negative `bufsize' means an unbounded channel ..
 coroc_chan_t _coroc_chan_allocate(int32_t elemsize, int32_t bufsize, bool isref);
+coroc_chan_t _coroc_unbounded_chan_allocate(int32_t elemsize, bool isref);
+
+coroc_chan_t coroc_prio_chan_allocate(int32_t elemsize, int32_t bufsize,
+                                      coroc_chan_prio_fn prio);
+
+// the `notify' is called once the backlog of an unbounded channel
+// exceeds the soft `watermark', and will be re-armed after the backlog
+// drops below it. NOTE it is called with the channel's lock held,
+// so it must not operate on the channel or block.
+void coroc_chan_set_watermark(coroc_chan_t chan, int64_t watermark,
+                              coroc_chan_watermark_t notify);
 void _coroc_chan_dealloc(coroc_chan_t chan);
 
+// the move channel carries the refcnt handles (`coroc_refcnt_t') only,
+// the ownership is transferred to the receiver on a successful send,
+// and the sender's handle is reset to NULL so it can not be touched again.
+// the handles left in the buffer are released when the channel is closed.
+coroc_chan_t _coroc_move_chan_allocate(int32_t bufsize);
+
 #define coroc_chan_allocate(es, bs) _coroc_chan_allocate(es, bs, false)
+#define coroc_move_chan_allocate(bs) _coroc_move_chan_allocate(bs)
+#define coroc_unbounded_chan_allocate(es) _coroc_unbounded_chan_allocate(es, false)
 #define coroc_chan_dealloc(chan) _coroc_chan_dealloc(chan)
 
 extern int _coroc_chan_send(coroc_chan_t chan, void *buf, bool block);
@@ -90,6 +177,10 @@ extern int _coroc_chan_recv(coroc_chan_t chan, void *buf, bool block);
 #define coroc_chan_nbsend(chan, buf) _coroc_chan_send(chan, buf, false)
 #define coroc_chan_nbrecv(chan, buf) _coroc_chan_recv(chan, buf, false)
 
+// wait at most `usec' microseconds, return CHAN_TIMEOUT if nothing happens.
+extern int coroc_chan_send_timeout(coroc_chan_t chan, void *buf, int64_t usec);
+extern int coroc_chan_recv_timeout(coroc_chan_t chan, void *buf, int64_t usec);
+
 #if 0
 extern int _coroc_chan_sendp(coroc_chan_t chan, void *ptr, bool block);
 extern int _coroc_chan_recvp(coroc_chan_t chan, void **pptr, bool block);
@@ -150,12 +241,17 @@ void coroc_chan_set_init(coroc_chan_set_t set, int n) {
 void coroc_chan_set_send(coroc_chan_set_t set, coroc_chan_t chan, void *buf);
 void coroc_chan_set_recv(coroc_chan_set_t set, coroc_chan_t chan, void *buf);
 
+// a positive `usec' bounds the blocking select,
+// `*active' is set to NULL and CHAN_TIMEOUT is returned if time out.
 extern int _coroc_chan_set_select(coroc_chan_set_t set, bool block,
-                                coroc_chan_t *active);
+                                  int64_t usec, coroc_chan_t *active);
 
-#define coroc_chan_set_select(set, pchan) _coroc_chan_set_select(set, true, pchan)
+#define coroc_chan_set_select(set, pchan) \
+  _coroc_chan_set_select(set, true, -1, pchan)
 #define coroc_chan_set_nbselect(set, pchan) \
-  _coroc_chan_set_select(set, false, pchan)
+  _coroc_chan_set_select(set, false, 0, pchan)
+#define coroc_chan_set_timedselect(set, usec, pchan) \
+  _coroc_chan_set_select(set, (usec) > 0, usec, pchan)
 
 static inline void __chan_memcpy(void *dst, const void *src, size_t size) {
   if (dst && src) memcpy(dst, src, size);
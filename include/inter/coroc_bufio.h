@@ -0,0 +1,72 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#ifndef _TSC_BUFIO_H_
+#define _TSC_BUFIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "support.h"
+#include "coroc_slab.h"
+
+// the default size of each buffer, it fits the 16KB slab class
+// together with the slab header ..
+#define TSC_BUFIO_DEFAULT_SIZE (16 * 1024 - sizeof(coroc_slab_hdr_t))
+
+/* the buffered reader / writer of a coroutine socket, its buffers
+ * are allocated from the slab on the first use. the fd is not owned,
+ * and one bufio must be used by one coroutine at a time. */
+typedef struct coroc_bufio {
+  int fd;
+  int size;
+  int64_t usec;  // the timeout of each blocking call, 0 means forever
+  int error;     // the sticky errno
+  bool eof;
+  // the unread data is in [rstart, rend) of the read buffer ..
+  char *rbuf;
+  int rstart, rend;
+  // the pending data is in [0, wlen) of the write buffer ..
+  char *wbuf;
+  int wlen;
+} *coroc_bufio_t;
+
+/// Alloc the bufio of the fd, the size <= 0 means the default one
+coroc_bufio_t coroc_bufio_open(int fd, int size);
+
+/// Flush the pending writes and release the buffers, the fd is kept
+int coroc_bufio_free(coroc_bufio_t bufio);
+
+/// Set the timeout of each blocking read or write, in microseconds
+void coroc_bufio_set_timeout(coroc_bufio_t bufio, int64_t usec);
+
+/* the reads return -1 with the errno set on errors, and
+ * the pending writes are always flushed before the reader
+ * goes to the kernel, so a request is never stuck in the
+ * buffer while its coroutine is waiting for the response. */
+
+/// Wait for at least `n' bytes (at most the buffer's size) without
+/// consuming them, return the bytes available, less than `n' on EOF
+int coroc_bufio_peek(coroc_bufio_t bufio, const char **data, int n);
+
+/// Drop the next `n' bytes, which must have been peeked
+void coroc_bufio_skip(coroc_bufio_t bufio, int n);
+
+/// Read at most `n' bytes, with at most one syscall
+int coroc_bufio_read(coroc_bufio_t bufio, void *buf, int n);
+
+/// Read exactly `n' bytes, less than `n' only on EOF
+int coroc_bufio_read_full(coroc_bufio_t bufio, void *buf, int n);
+
+/// Read until the `delim' (included) or `n' bytes, whichever comes first
+int coroc_bufio_read_until(coroc_bufio_t bufio, int delim, char *buf, int n);
+
+/// Append to the write buffer, the pending bytes and a big write
+/// go together in one `writev' once the buffer is full
+int coroc_bufio_write(coroc_bufio_t bufio, const void *buf, int n);
+
+/// Write out all the pending bytes
+int coroc_bufio_flush(coroc_bufio_t bufio);
+
+#endif  // _TSC_BUFIO_H_
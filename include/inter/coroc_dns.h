@@ -0,0 +1,24 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#ifndef _TSC_DNS_H_
+#define _TSC_DNS_H_
+
+#include <stdint.h>
+
+/* the coroutine DNS resolver of the IPv4 addresses. a name is looked
+ * up in the /etc/hosts first, then queried by UDP (and TCP if the answer
+ * is truncated) from the servers of /etc/resolv.conf through the netpoll,
+ * so only the calling coroutine waits. the answers are cached for their
+ * TTLs, and the concurrent lookups of one name share a single query.
+ * the names are taken as they are, there is no search domain. */
+
+/// Look up the `name', 0 on success, or -1 with the errno set,
+/// ENOENT if the name does not exist or has no address
+int coroc_dns_lookup(const char *name, uint32_t *ip);
+
+/// Use the server at `ip:port' instead of the ones in /etc/resolv.conf
+int coroc_dns_set_server(const char *ip, int port);
+
+#endif  // _TSC_DNS_H_
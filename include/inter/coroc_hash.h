@@ -30,17 +30,20 @@
 #define N 8232341
 
 /** The entry of the hash table. */
-typedef struct {
+typedef struct hash_entry {
   uint64_t key;
   void *value;
+  struct hash_entry *next;  // in the overflow chain
 } hash_entry_t;
 
 /** The structure of the hash table. */
-typedef struct {
+typedef struct hash {
   coroc_lock lock;
   int capacity;
   int cursor;
+  int size;  // the entries in both the tables and the chain
   hash_entry_t **table[2];
+  hash_entry_t *chain;  // the colliding ones which can't be placed
 } hash_t;
 
 void hash_init(hash_t *hash);
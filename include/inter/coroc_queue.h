@@ -9,6 +9,7 @@
 #include <stdbool.h>
 #include <assert.h>
 
+#include "support.h"
 #include "coroc_lock.h"
 
 struct queue;
@@ -260,6 +261,69 @@ static inline void atomic_queue_walk(queue_t *queue,
   }
 }
 
+/*-----------------------------------*
+ * The intrusive lock-free MPSC queue *
+ * (Vyukov), any threads can push,    *
+ * but only one consumer can pop !    *
+ *-----------------------------------*/
+typedef struct mpsc_queue {
+  queue_item_t *volatile head;  // the last pushed item
+  queue_item_t *tail;           // the next item to pop
+  queue_item_t stub;
+} mpsc_queue_t;
+
+static inline void mpsc_queue_init(mpsc_queue_t *queue) {
+  queue_item_init(&queue->stub, NULL);
+  queue->head = queue->tail = &queue->stub;
+}
+
+static inline void mpsc_queue_push(mpsc_queue_t *queue, queue_item_t *item) {
+  item->next = NULL;
+  queue_item_t *prev = TSC_XCHG(&queue->head, item);
+  // the consumer may see the item before it is linked,
+  // then it will think the queue is empty for a moment ..
+  __atomic_store_n(&prev->next, item, __ATOMIC_RELEASE);
+}
+
+// only the consumer can call this ..
+static inline bool mpsc_queue_empty(mpsc_queue_t *queue) {
+  return queue->tail == &queue->stub &&
+         TSC_ATOMIC_READ(queue->head) == &queue->stub;
+}
+
+// return NULL if the queue is empty or the next item is being linked,
+// only the consumer can call this ..
+static inline void *mpsc_queue_try_rem(mpsc_queue_t *queue) {
+  queue_item_t *tail = queue->tail;
+  queue_item_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (tail == &queue->stub) {
+    if (next == NULL) return NULL;
+    queue->tail = tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next == NULL) {
+    if (tail != TSC_ATOMIC_READ(queue->head)) return NULL;
+    // the last one, push the stub back to keep the queue non-empty ..
+    mpsc_queue_push(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) return NULL;
+  }
+
+  queue->tail = next;
+  tail->next = NULL;
+  return tail->owner;
+}
+
+// pop one item, wait for the pusher who is linking it if need ..
+static inline void *mpsc_queue_rem(mpsc_queue_t *queue) {
+  void *owner;
+  while ((owner = mpsc_queue_try_rem(queue)) == NULL)
+    if (mpsc_queue_empty(queue)) break;
+  return owner;
+}
+
 // -- general pointer inspector callback --
 static bool general_inspector(void *p0, void *p1) { return p0 == p1; }
 
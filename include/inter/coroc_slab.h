@@ -0,0 +1,42 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#ifndef _TSC_SUPPORT_SLAB_H_
+#define _TSC_SUPPORT_SLAB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// the size classes are 64B, 128B, .. 64KB,
+// larger objects are allocated from the heap directly.
+#define TSC_SLAB_MIN_SHIFT 6
+#define TSC_SLAB_CLASS_NUM 11
+
+// the max bytes cached by each VPU for one size class
+#define TSC_SLAB_CACHE_BYTES (256 * 1024)
+#define TSC_SLAB_CACHE_MIN 4
+
+#define TSC_SLAB_CLASS_SIZE(c) (((size_t)1) << ((c) + TSC_SLAB_MIN_SHIFT))
+
+// the per-VPU free list of one size class,
+// only accessed by its owner VPU, so no lock is needed.
+typedef struct coroc_slab_cache {
+  void *head;
+  uint32_t count;
+} coroc_slab_cache_t;
+
+// the header ahead of each object, keep the 16 bytes alignment.
+typedef struct coroc_slab_hdr {
+  uint32_t cls;
+  uint32_t __pad[3];
+} coroc_slab_hdr_t;
+
+void coroc_slab_cache_init(coroc_slab_cache_t *caches);
+
+// the object freed on any VPU goes to that VPU's free list,
+// the async threads fall back to the heap.
+void *coroc_slab_alloc(size_t size);
+void coroc_slab_free(void *ptr);
+
+#endif  // _TSC_SUPPORT_SLAB_H_
@@ -14,51 +14,107 @@
 #include "coroutine.h"
 
 struct coroc_timer;
+struct coroc_timer_shard;
 
 /* internal timer type */
 typedef struct {
   uint64_t when;
+  uint64_t ideal;  // the `when' before coalesced, the periodic ones follow it
   uint32_t period;
+  uint32_t slack;  // the deadline may be delayed by at most `slack' us
   int32_t index;
+#if defined(ENABLE_TIMER_WHEEL)
+  queue_item_t link;  // linked in one slot of the timer wheel
+#endif
   void (*func)(void *);
   void *args;
   struct coroc_timer *owner;
+  struct coroc_timer_shard *shard;  // NULL if not armed
 } coroc_inter_timer_t;
 
 /* userspace timer type */
 typedef struct coroc_timer {
   struct coroc_buffered_chan _chan;
   uint64_t _buffer;
+  uint32_t missed;  // the ticks dropped since the last check
+  uint32_t firing;  // the tick of `due' is being sent by a scheduler
+  uint64_t due;
+  struct coroc_timer *next;  // in the shard's list of the fired ones
   coroc_inter_timer_t timer;
 } *coroc_timer_t;
 
 /* userspace api */
 
+// the `func' is called by a VPU scheduler before each tick is sent,
+// with none of the timers' locks held, so it may take the locks, but
+// it should return soon, no coroutine runs on that VPU meanwhile ..
 coroc_timer_t coroc_timer_allocate(uint32_t period, void (*func)(void));
 void coroc_timer_dealloc(coroc_timer_t);
 coroc_chan_t coroc_timer_after(coroc_timer_t, uint64_t);
 coroc_chan_t coroc_timer_at(coroc_timer_t, uint64_t);
+coroc_chan_t coroc_timer_phase(coroc_timer_t, uint64_t);
+uint32_t coroc_timer_missed(coroc_timer_t);
 
 int coroc_timer_start(coroc_timer_t);
 int coroc_timer_stop(coroc_timer_t);
 int coroc_timer_reset(coroc_timer_t, uint64_t);
+void coroc_timer_set_slack(coroc_timer_t, uint32_t);
+
+// the default slack of the channel and netpoll timeouts, in microseconds,
+// set by the `TSC_TIMER_SLACK' env, 0 means exact ..
+extern uint32_t coroc_timer_slack;
 
 /* internal api */
 int coroc_add_intertimer(coroc_inter_timer_t *);
 int coroc_del_intertimer(coroc_inter_timer_t *);
 
-/* get current time */
+/* called by the VPU schedulers */
+void coroc_intertimer_expire(uint32_t);
+uint64_t coroc_intertimer_next(void);
+
+/* get current time, from the monotonic clock which never jumps */
+#if defined(ENABLE_TSC_CLOCK)
+// the TSC calibrated against the monotonic clock at boot,
+// the `mult' is 0 if the TSC is not invariant and can't be used ..
+typedef struct {
+  uint64_t tsc;
+  int64_t ns;
+  uint64_t mult;  // nanoseconds per tick, fixed point with 32 bits fraction
+} coroc_tsc_clock_t;
+
+extern coroc_tsc_clock_t coroc_tsc_clock;
+#endif
+
+static inline int64_t coroc_getnanotime(void) {
+#if defined(ENABLE_TSC_CLOCK)
+  if (coroc_tsc_clock.mult != 0) {
+    uint64_t delta = __builtin_ia32_rdtsc() - coroc_tsc_clock.tsc;
+    return coroc_tsc_clock.ns +
+           (int64_t)(((__uint128_t)delta * coroc_tsc_clock.mult) >> 32);
+  }
+#endif
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
 static inline int64_t coroc_getmicrotime(void) {
-  struct timeval tv;
-  struct timezone tz;
-  gettimeofday(&tv, &tz);
-  return tv.tv_sec * 1000000 + tv.tv_usec;
+  return coroc_getnanotime() / 1000;
 }
 
-static inline int64_t coroc_getnanotime(void) {
-  struct timespec abstime;
-  clock_gettime(CLOCK_REALTIME, &abstime);
-  return abstime.tv_sec * 1000000000LL + abstime.tv_nsec;
+// the microseconds cached by the current VPU, read at most once
+// per scheduling pass, so it may be behind the real time by the
+// running time of the current coroutine ..
+int64_t coroc_getcachedtime(void);
+
+// the internal timeouts run with the timer shard's lock held, so they
+// never wait for another lock, they re-arm the timer to retry later if
+// it is busy. NOTE a contended lock turns one timeout into the repeated
+// firings every `TSC_TIMER_RETRY' us until the lock is acquired ..
+#define TSC_TIMER_RETRY 10
+
+static inline void coroc_intertimer_retry(coroc_inter_timer_t *timer) {
+  timer->when = coroc_getcachedtime() + TSC_TIMER_RETRY;
 }
 
 void coroc_udelay(uint64_t us);
@@ -0,0 +1,48 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#ifndef _TSC_TIMER_WHEEL_H_
+#define _TSC_TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+#include "support.h"
+#include "coroc_queue.h"
+#include "coroc_time.h"
+
+// the hierarchical timing wheel, one tick is one microsecond,
+// the level `l' has 256 slots and each slot of it covers 256^l ticks,
+// so the 4 levels cover about 71 minutes, the later timers are kept
+// in the last slot of the top level and cascaded again and again ..
+#define TSC_TIMER_WHEEL_BITS 8
+#define TSC_TIMER_WHEEL_SLOTS (1 << TSC_TIMER_WHEEL_BITS)
+#define TSC_TIMER_WHEEL_MASK (TSC_TIMER_WHEEL_SLOTS - 1)
+#define TSC_TIMER_WHEEL_LEVELS 4
+
+typedef struct coroc_timer_wheel {
+  uint64_t curr;   // the next tick to expire
+  uint32_t size;   // the number of the timers in the wheel
+  // the non-empty slots of each level, for skipping the empty ones fast ..
+  uint64_t bitmap[TSC_TIMER_WHEEL_LEVELS][TSC_TIMER_WHEEL_SLOTS / 64];
+  queue_t slots[TSC_TIMER_WHEEL_LEVELS][TSC_TIMER_WHEEL_SLOTS];
+} coroc_timer_wheel_t;
+
+void coroc_timer_wheel_init(coroc_timer_wheel_t *wheel, uint64_t now);
+
+// O(1) insert and cancel, `del' returns -1 if the timer is not in the wheel.
+void coroc_timer_wheel_add(coroc_timer_wheel_t *wheel,
+                           coroc_inter_timer_t *timer);
+int coroc_timer_wheel_del(coroc_timer_wheel_t *wheel,
+                          coroc_inter_timer_t *timer);
+
+// move all the timers expired before `now' into the `expired' queue,
+// in the order of their deadlines ..
+void coroc_timer_wheel_advance(coroc_timer_wheel_t *wheel, uint64_t now,
+                               queue_t *expired);
+
+// the tick before which nothing will expire,
+// it may be earlier than the real next deadline ..
+uint64_t coroc_timer_wheel_next(coroc_timer_wheel_t *wheel);
+
+#endif  // _TSC_TIMER_WHEEL_H_
@@ -53,6 +53,8 @@ typedef struct coroc_coroutine {
 
   int sigmask_nest;
 
+  int splice_pipe[2];  // for the `coroc_net_splice', made on the first use
+
   uint32_t detachstate;
   void* stack_base;
   size_t stack_size;
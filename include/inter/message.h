@@ -7,19 +7,48 @@
 
 #include "channel.h"
 
+struct hash;
+
+// the mailbox of each coroutine, the senders push the messages
+// into the lock-free `mque' and only the owner pops them ..
 typedef struct coroc_async_chan {
   struct coroc_chan _chan;
-  queue_t mque;
+  mpsc_queue_t mque;
+  // the messages skipped by the tagged receives, in the arrival order,
+  // and the index of them by tag, only touched by the owner ..
+  queue_t stash;
+  struct hash *tags;
 } *coroc_async_chan_t;
 
+// the payloads not larger than this are stored inline in the mailbox item
+#define TSC_MSG_INLINE_MAX 1024
+
+// how the payload of a message is carried:
+//  OWNED -- `msg' is a heap buffer, the ownership is passed with the message,
+//  COPY  -- `msg' is a buffer of the caller, the payload is copied in / out,
+//  ITEM  -- the receiver gets the mailbox item itself in `msg',
+//  NEW   -- like ITEM, but skip the stashed ones, used by the tagged receive.
+enum {
+  TSC_MSG_OWNED = 0,
+  TSC_MSG_COPY = 1,
+  TSC_MSG_ITEM = 2,
+  TSC_MSG_NEW = 3,
+};
+
 typedef struct coroc_msg {
   int32_t size;
+  int32_t mode;
   void *msg;
+  uint64_t tag;  // 0 for the untagged messages
 } coroc_msg_t;
 
-typedef struct {
+// the mailbox item, allocated from the per-VPU slab caches,
+// the small payload follows the item in the same object ..
+typedef struct coroc_msg_item {
   struct coroc_msg _msg;
   queue_item_t link;
+  queue_item_t tag_link;
+  uint8_t data[0];
 } *coroc_msg_item_t;
 
 struct coroc_coroutine;
@@ -33,4 +62,27 @@ extern int coroc_recv(void *, int32_t, bool);
 extern int coroc_sendp(struct coroc_coroutine *, void *, int32_t);
 extern int coroc_recvp(void **, int32_t *, bool);
 
+// the tagged receive only gets the first message with the given tag,
+// the other messages are kept in order for the later receives ..
+extern int coroc_send_tagged(struct coroc_coroutine *, uint64_t, void *,
+                             int32_t);
+extern int coroc_recv_tagged(uint64_t, void *, int32_t, bool);
+
+// receive all the pending messages, at most `max' ones, in one call,
+// the number received is set to `*n'. the payloads stay in the items,
+// which must be freed after using. return CHAN_SUCCESS if any received,
+// CHAN_BUSY if none and not blocking, or CHAN_CLOSED ..
+extern int coroc_recv_batch(coroc_msg_item_t *msgs, int max, int *n,
+                            bool block);
+extern void coroc_msg_batch_free(coroc_msg_item_t *, int);
+
+// the payload of a received item and its size ..
+static inline void *coroc_msg_item_data(coroc_msg_item_t item) {
+  return item->_msg.msg;
+}
+
+static inline int32_t coroc_msg_item_size(coroc_msg_item_t item) {
+  return item->_msg.size;
+}
+
 #endif  // _TSC_CORE_MESSAGE_H_
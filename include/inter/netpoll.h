@@ -7,8 +7,11 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "coroc_lock.h"
+#include "coroc_queue.h"
 #include "coroc_time.h"
 #include "support.h"
 #include "coroutine.h"
@@ -18,39 +21,161 @@
 
 enum { TSC_NETPOLL_READ = 1, TSC_NETPOLL_WRITE = 2, TSC_NETPOLL_ERROR = 4 };
 
+struct coroc_poll_desc;
+
+// one coroutine parked on a poll descriptor, lives on its stack ..
+typedef struct coroc_poll_wait {
+  coroc_coroutine_t wait;
+  struct coroc_poll_desc *desc;
+  int mode;  // the waiting modes, and the result, 0 if timed out
+  bool parked;
+  queue_item_t link[3];          // in the readers / writers / errors queue
+  struct coroc_poll_wait *wake;  // in the list to be readied
+} coroc_poll_wait_t;
+
+// the long-lived poll descriptor of each fd, it is registered to the
+// backend once for both directions (edge-triggered) by the first wait,
+// and kept until the fd is closed by `coroc_net_close' ..
 typedef struct coroc_poll_desc {
-  struct coroc_refcnt refcnt;
-  bool done;
   int fd;
-  int mode;
-  int id;  // for fast delete ...
-  coroc_coroutine_t wait;
-  coroc_inter_timer_t *deadline;
+  int id;       // for the poll backend, -1 if not in its array
+  int shard;    // the VPU's poller it is registered to
+  bool registered;
+  int ready;    // the cached readiness not consumed by any waiter yet
+  queue_t rw[3];  // the parked readers, writers and error queue waiters
   coroc_lock lock;
+  bool zerocopy;  // the SO_ZEROCOPY is set by `coroc_net_zerocopy'
+  uint32_t zc_sent, zc_done;  // the MSG_ZEROCOPY sends and completions
+#if defined(ENABLE_IO_URING)
+  void *uring;    // the multishot request posted to the io_uring
+  int ops;        // the single-shot requests in flight
+  bool nouring;   // not a socket, always waited for the readiness
+#endif
 } *coroc_poll_desc_t;
 
-// internal netpoll API..
-int __coroc_netpoll_init(int max);
+// internal netpoll API, implemented by each backend,
+// the fds are registered to the desc's shard ..
+int __coroc_netpoll_init(int nshard, int max);
 int __coroc_netpoll_add(coroc_poll_desc_t desc);
 int __coroc_netpoll_rem(coroc_poll_desc_t desc);
+// the modes of the parked waiters are changed, with the desc's lock held,
+// only the level-triggered backends care about it ..
+int __coroc_netpoll_arm(coroc_poll_desc_t desc, int mode);
 int __coroc_netpoll_fini(void);
+// poll the given VPU's shard, or all of them if it is -1,
+// a busy VPU also polls one shard in turn every `TSC_NETPOLL_POLL_PASSES'
+// passes of its scheduler, so the batched requests are always submitted
+// and reaped, even if the VPU owning them is busy or sleeping ..
+#define TSC_NETPOLL_POLL_PASSES 64  // must be a power of 2
+bool __coroc_netpoll_polling(int shard, int timeout);
+int __coroc_netpoll_timer(uint64_t when);  // -1 if not supported
+// submit the requests queued by the shard if the backend batches them ..
+void __coroc_netpoll_flush(int shard);
+
 int __coroc_netpoll_size(void);
-bool __coroc_netpoll_polling(int timeout);
+void __coroc_netpoll_reset(int fd);
+coroc_poll_desc_t __coroc_netpoll_desc(int fd);
 
-void coroc_netpoll_initialize(void);
-int coroc_netpoll_wakeup(coroc_poll_desc_t desc);
+#if defined(ENABLE_IO_URING)
+// the io_uring backend, one ring per VPU next to its epoll shard.
+// the reads, writes, accepts and connects are posted as the requests
+// instead of waiting for the readiness, they return the negative errno,
+// or -ENOSYS if the ring is not available and -EAGAIN if the fd must be
+// waited for its readiness. the data received by the multishot recv
+// is queued in the ring's buffers, so never read such an fd directly ..
+int __coroc_uring_init(int nshard);
+int __coroc_uring_fd(int shard);
+int __coroc_uring_size(void);
+void __coroc_uring_flush(int shard, bool wait);
+bool __coroc_uring_polling(int shard);
+coroc_poll_wait_t *__coroc_uring_detach(coroc_poll_desc_t desc,
+                                        coroc_poll_wait_t *list);
+bool __coroc_uring_streamed(coroc_poll_desc_t desc);
+
+int __coroc_uring_recv(int fd, void *buf, int n, int64_t usec);
+int __coroc_uring_send(int fd, const void *buf, int n, int64_t usec);
+int __coroc_uring_accept(int fd, int64_t usec);
+int __coroc_uring_connect(int fd, const struct sockaddr *sa, socklen_t len,
+                          int64_t usec);
+#endif
+
+void coroc_netpoll_initialize(int np);
+// called by the backends when the fd becomes ready ..
+void coroc_netpoll_ready(coroc_poll_desc_t desc, int mode);
 
 // the public netpoll API ..
 int coroc_net_nonblock(int fd);
 int coroc_net_read(int fd, void *buf, int size);
 int coroc_net_timed_read(int fd, void *buf, int size, int64_t usec);
 int coroc_net_write(int fd, void *buf, int size);
+// the fds are polled edge-triggered, so wait only after the syscall
+// gets EAGAIN, a waiter that doesn't drain the fd first may hang ..
 int coroc_net_wait(int fd, int mode);
 int coroc_net_timedwait(int fd, int mode, int64_t usec);
+int coroc_net_close(int fd);
+
+// the vectored and message based I/O, the readv / writev / sendmsg
+// go on until all the vectors are done (or EOF) like the read / write,
+// but the recvmsg returns after one message. the MSG_ERRQUEUE of the
+// recvmsg waits for the error queue instead of the data ..
+ssize_t coroc_net_readv(int fd, const struct iovec *iov, int cnt);
+ssize_t coroc_net_writev(int fd, const struct iovec *iov, int cnt);
+ssize_t coroc_net_sendmsg(int fd, const struct msghdr *msg, int flags);
+ssize_t coroc_net_recvmsg(int fd, struct msghdr *msg, int flags);
+
+// the MSG_ZEROCOPY sends of the `coroc_net_sendmsg', the buffers must be
+// kept until they are completed. each send syscall is numbered from 0 per
+// fd, and `coroc_net_zerocopy_sent' returns the number of them so far.
+// the wait reaps the error queue until the first `seq' sends complete,
+// it returns the number of the reaped ones copied by the kernel anyway ..
+int coroc_net_zerocopy(int fd);
+uint32_t coroc_net_zerocopy_sent(int fd);
+int coroc_net_zerocopy_wait(int fd, uint32_t seq, int64_t usec);
+
+// forward at most `len' bytes from `fd_in' to `fd_out' through the
+// coroutine's pipe pair, it returns once they are all written out,
+// or 0 on the EOF of `fd_in' ..
+ssize_t coroc_net_splice(int fd_in, int fd_out, size_t len);
+// send `count' bytes of the file to the socket, less only on EOF ..
+ssize_t coroc_net_sendfile(int fd_out, int fd_in, off_t *offset,
+                           size_t count);
 
+// the backlog of the listening socket is SOMAXCONN by default ..
 int coroc_net_announce(bool istcp, const char *server, int port);
+int coroc_net_announce_backlog(bool istcp, const char *server, int port,
+                               int backlog);
 int coroc_net_timed_accept(int fd, char *server, int *port, int64_t usec);
 int coroc_net_accept(int fd, char *server, int *port);
+// accept at most `n' connections into `cfds', all the queued ones are
+// taken before it waits, and it returns once there is at least one ..
+int coroc_net_accept_many(int fd, int *cfds, int n);
+
+// a group of SO_REUSEPORT tcp listeners of the same port, one per VPU,
+// so the kernel spreads the connections over them. each listener must
+// have its own acceptor coroutine, or its connections are never taken ..
+typedef struct coroc_net_listeners {
+  int num;
+  int fds[];
+} *coroc_net_listeners_t;
+
+coroc_net_listeners_t coroc_net_announce_listeners(const char *server,
+                                                   int port, int backlog);
+void coroc_net_listeners_close(coroc_net_listeners_t ls);
+
+// the batched datagram I/O (linux only), the recvmmsg returns all the
+// queued datagrams up to `n' by one syscall and waits only if there is
+// none, the sendmmsg goes on until all the `n' are sent ..
+struct mmsghdr;
+int coroc_net_recvmmsg(int fd, struct mmsghdr *msgs, int n, int flags);
+int coroc_net_sendmmsg(int fd, struct mmsghdr *msgs, int n, int flags);
+// with the UDP GRO, a received message may hold several datagrams of
+// the size given by `coroc_net_udp_segment' (0 if it's a single one),
+// the message needs a control buffer of CMSG_SPACE(sizeof(int)) for it.
+// with the UDP GSO, each buffer sent is split into the datagrams of
+// `size' bytes by the kernel, 0 turns it off ..
+int coroc_net_udp_gro(int fd, bool on);
+int coroc_net_udp_gso(int fd, int size);
+int coroc_net_udp_segment(const struct msghdr *msg);
 int coroc_net_lookup(const char *name, uint32_t *ip);
 int coroc_net_timed_dial(bool istcp, const char *server, int port, int64_t usec);
 int coroc_net_dial(bool istcp, const char *server, int port);
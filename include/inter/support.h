@@ -142,11 +142,13 @@ typedef pthread_t TSC_OS_THREAD_T;
 #if defined(__APPLE__) && !defined(__i386__) && !defined(__x86_64__)
 #define TSC_ATOMIC_INC(n) (++(n))
 #define TSC_ATOMIC_DEC(n) (--(n))
+#define TSC_ATOMIC_ADD(n, v) ((n) += (v))
 #define TSC_SYNC_ALL()
 // TODO # define TSC_CAS(pval, old, new)
 #else
 #define TSC_ATOMIC_INC(n) __sync_add_and_fetch(&(n), 1)
 #define TSC_ATOMIC_DEC(n) __sync_add_and_fetch(&(n), -1)
+#define TSC_ATOMIC_ADD(n, v) __sync_add_and_fetch(&(n), (v))
 
 #define TSC_ATOMIC_READ(n) __atomic_load_n(&(n), __ATOMIC_SEQ_CST)
 #define TSC_ATOMIC_WRITE(n, v) __atomic_store_n(&(n), v, __ATOMIC_SEQ_CST)
@@ -157,7 +159,7 @@ typedef pthread_t TSC_OS_THREAD_T;
 #define TSC_SYNC_ALL() __sync_synchronize()
 #endif
 
-#if defined(__GNUC__) && (__GNUC__ < 4 || __GNUC_MINOR__ < 7)
+#if defined(__GNUC__) && (__GNUC__ < 4 || (__GNUC__ == 4 && __GNUC_MINOR__ < 7))
 #undef TSC_SYNC_ALL
 #undef TSC_XCHG
 #undef TSC_ATOMIC_READ
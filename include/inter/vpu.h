@@ -10,6 +10,7 @@
 #include "coroutine.h"
 #include "support.h"
 #include "coroc_queue.h"
+#include "coroc_slab.h"
 
 // The unlock handler type
 typedef void (*unlock_handler_t)(volatile void *lock);
@@ -30,13 +31,18 @@ typedef struct vpu {
   bool initialized;
   uint32_t watchdog;
   uint32_t ticks;
+  uint32_t passes;  // the scheduler's passes, to poll the net IO in turn
   unsigned rand_seed;
+  int64_t now;  // the cached time, 0 if not read in this pass ..
   coroc_coroutine_t current;
   coroc_coroutine_t scheduler;
   
   // the private queues for each priority level:
   p_task_que xt[TSC_PRIO_NUM];
 
+  // the private slab caches for each size class:
+  coroc_slab_cache_t slab[TSC_SLAB_CLASS_NUM];
+
   void *hold;
   unlock_handler_t unlock_handler;
 } vpu_t;
@@ -72,6 +78,7 @@ extern void coroc_vpu_initialize(int cpu_mp_count, coroc_coroutine_handler_t ent
 
 extern void vpu_suspend(volatile void *lock, unlock_handler_t handler);
 extern void vpu_ready(coroc_coroutine_t coroutine, bool);
+extern void vpu_ready_batch(coroc_coroutine_t *coroutines, int n);
 extern void vpu_syscall(int (*pfn)(void *));
 extern void vpu_clock_handler(int);
 extern void vpu_wakeup_one(void);
@@ -22,9 +22,12 @@ extern "C" {
 #include "inter/support.h"
 #include "inter/coroutine.h"
 #include "inter/channel.h"
+#include "inter/broadcast.h"
 #include "inter/message.h"
 #include "inter/async.h"
 #include "inter/netpoll.h"
+#include "inter/coroc_bufio.h"
+#include "inter/coroc_dns.h"
 #include "inter/coroc_group.h"
 #include "inter/coroc_time.h"
 #include "inter/vfs.h"
@@ -175,7 +178,7 @@ extern "C" {
 
 #define __CoroC_Select(S, B) ({ \
     coroc_chan_t active = NULL;   \
-    _coroc_chan_set_select(S, B, &active); \
+    _coroc_chan_set_select(S, B, -1, &active); \
     active; })
 #define __CoroC_Select_SendExpr(S, C, E) \
     do { typeof(E) __temp = E; \
@@ -211,7 +214,13 @@ extern "C" {
     coroc_timer_after(__ticker, period);  \
     (coroc_chan_t)(__ticker); })
 
+#define __CoroC_Ticker_Phase(period, phase) ({ \
+    coroc_timer_t __ticker = coroc_timer_allocate(period, NULL); \
+    coroc_timer_phase(__ticker, phase);  \
+    (coroc_chan_t)(__ticker); })
+
 #define __CoroC_Stop(T)  coroc_timer_stop((coroc_timer_t)(T))
+#define __CoroC_Missed(T)  coroc_timer_missed((coroc_timer_t)(T))
 
 /// for time management
 #define __CoroC_Now     coroc_getmicrotime
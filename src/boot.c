@@ -14,9 +14,9 @@
 
 extern void coroc_vpu_initialize(int, coroc_coroutine_handler_t);
 extern void coroc_clock_initialize(void);
-extern void coroc_intertimer_initialize(void);
+extern void coroc_intertimer_initialize(int, int);
 extern void coroc_async_pool_initialize(int);
-extern void coroc_netpoll_initialize(void);
+extern void coroc_netpoll_initialize(int);
 extern void coroc_profiler_initialize(int);
 
 int __argc;
@@ -36,6 +36,7 @@ static bool __coroc_env2int(const char *env, int *ret) {
 int coroc_boot(int argc, char **argv, int np, int nasync,
              coroc_coroutine_handler_t entry) {
   int profile = 0;
+  int slack = 0;
 
   __argc = argc;
   __argv = argv;
@@ -50,10 +51,11 @@ int coroc_boot(int argc, char **argv, int np, int nasync,
   }
 
   __coroc_env2int("TSC_PROFILE", &profile);
+  __coroc_env2int("TSC_TIMER_SLACK", &slack);
 
   coroc_clock_initialize();
-  coroc_intertimer_initialize();
-  coroc_netpoll_initialize();
+  coroc_intertimer_initialize(np, slack);
+  coroc_netpoll_initialize(np);
   coroc_async_pool_initialize(nasync);
   coroc_vpu_initialize(np, entry);
   coroc_profiler_initialize(profile);
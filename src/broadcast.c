@@ -0,0 +1,296 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <string.h>
+#include <assert.h>
+
+#include "support.h"
+#include "broadcast.h"
+#include "vpu.h"
+#include "coroutine.h"
+
+#define TSC_BCAST_WAKEUP_BATCH 64
+
+TSC_SIGNAL_MASK_DECLARE
+
+// the blocked publishers wait on the `send_que' and
+// the blocked subscribers wait on the `recv_que' ..
+typedef struct bcast_waiter {
+  coroc_coroutine_t coroutine;
+  queue_item_t link;
+} bcast_waiter;
+
+static inline void __bcast_wait(coroc_bcast_t bcast, queue_t *que) {
+  bcast_waiter w;
+  w.coroutine = coroc_coroutine_self();
+  queue_item_init(&w.link, &w);
+  queue_add(que, &w.link);
+  vpu_suspend(&bcast->_chan.lock, (unlock_handler_t)(lock_release));
+  // awaken by others later ..
+  lock_acquire(&bcast->_chan.lock);
+}
+
+// detach all waiters from the given queue, must hold the lock ..
+static inline queue_item_t *__bcast_detach(queue_t *que) {
+  queue_item_t *head = que->head;
+  queue_init(que);
+  return head;
+}
+
+// wakeup all the detached waiters, must NOT hold the lock.
+// the waiter is on the stack of a suspended coroutine,
+// so its link must be read before the coroutine being readied.
+static void __bcast_wakeup(queue_item_t *item) {
+  coroc_coroutine_t batch[TSC_BCAST_WAKEUP_BATCH];
+  int n = 0;
+
+  while (item != NULL) {
+    bcast_waiter *w = item->owner;
+    item = item->next;
+    batch[n++] = w->coroutine;
+
+    if (n == TSC_BCAST_WAKEUP_BATCH) {
+      vpu_ready_batch(batch, n);
+      n = 0;
+    }
+  }
+
+  vpu_ready_batch(batch, n);
+}
+
+// re-calculate the min cursor of all subscribers,
+// return true if the tail is moved forward ..
+static bool __bcast_update_tail(coroc_bcast_t bcast) {
+  uint64_t tail = bcast->head;
+  uint32_t ntail = 0;
+  queue_item_t *item = bcast->subs.head;
+
+  for (; item != NULL; item = item->next) {
+    coroc_bcast_sub_t sub = item->owner;
+    if (sub->cursor < tail) {
+      tail = sub->cursor;
+      ntail = 1;
+    } else if (sub->cursor == tail) {
+      ntail++;
+    }
+  }
+
+  bool moved = (tail > bcast->tail);
+  bcast->tail = tail;
+  bcast->ntail = ntail;
+  return moved;
+}
+
+// the subscriber at the tail leaves the tail,
+// return the blocked publishers need to be awaken ..
+static queue_item_t *__bcast_leave_tail(coroc_bcast_t bcast, uint64_t cursor) {
+  if (bcast->policy == TSC_BCAST_OVERWRITE || cursor != bcast->tail)
+    return NULL;
+
+  if (--(bcast->ntail) == 0 && __bcast_update_tail(bcast))
+    return __bcast_detach(&bcast->_chan.send_que);
+
+  return NULL;
+}
+
+coroc_bcast_t coroc_bcast_allocate(int32_t elemsize, int32_t bufsize,
+                                   int policy) {
+  assert(bufsize > 0);
+
+  coroc_bcast_t bcast =
+      TSC_ALLOC(sizeof(struct coroc_bcast_chan) + elemsize * bufsize);
+  assert(bcast != NULL);
+
+  coroc_chan_init((coroc_chan_t)bcast, elemsize, false, NULL, NULL);
+  // re-init the refcnt's release handler ..
+  coroc_refcnt_init(&(bcast->_chan.refcnt),
+                    (release_handler_t)(coroc_bcast_dealloc));
+
+  bcast->policy = policy;
+  bcast->bufsize = bufsize;
+  bcast->head = bcast->tail = 0;
+  bcast->ntail = 0;
+  bcast->dropped = 0;
+  bcast->buf = (uint8_t *)(bcast + 1);
+  queue_init(&bcast->subs);
+
+  return bcast;
+}
+
+void coroc_bcast_dealloc(coroc_bcast_t bcast) {
+  coroc_bcast_close(bcast);
+  lock_fini(&bcast->_chan.lock);
+  TSC_DEALLOC(bcast);
+}
+
+int coroc_bcast_close(coroc_bcast_t bcast) {
+  queue_item_t *publishers = NULL, *subscribers = NULL;
+  int ret = CHAN_SUCCESS;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&bcast->_chan.lock);
+
+  if (bcast->_chan.close) {
+    ret = CHAN_CLOSED;
+  } else {
+    bcast->_chan.close = true;
+    publishers = __bcast_detach(&bcast->_chan.send_que);
+    subscribers = __bcast_detach(&bcast->_chan.recv_que);
+  }
+
+  lock_release(&bcast->_chan.lock);
+
+  __bcast_wakeup(publishers);
+  __bcast_wakeup(subscribers);
+
+  TSC_SIGNAL_UNMASK();
+  return ret;
+}
+
+coroc_bcast_sub_t coroc_bcast_subscribe(coroc_bcast_t bcast) {
+  coroc_bcast_sub_t sub = TSC_ALLOC(sizeof(struct coroc_bcast_sub));
+  assert(sub != NULL);
+
+  // each subscriber holds a reference of the broadcast channel ..
+  sub->bcast = coroc_refcnt_get(bcast);
+  sub->lagged = 0;
+  queue_item_init(&sub->link, sub);
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&bcast->_chan.lock);
+
+  sub->cursor = bcast->head;
+  if (bcast->subs.status == 0) {
+    bcast->tail = bcast->head;
+    bcast->ntail = 1;
+  } else if (bcast->tail == bcast->head) {
+    bcast->ntail++;
+  }
+  queue_add(&bcast->subs, &sub->link);
+
+  lock_release(&bcast->_chan.lock);
+  TSC_SIGNAL_UNMASK();
+
+  return sub;
+}
+
+void coroc_bcast_unsubscribe(coroc_bcast_sub_t sub) {
+  coroc_bcast_t bcast = sub->bcast;
+  queue_item_t *publishers;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&bcast->_chan.lock);
+
+  queue_extract(&bcast->subs, &sub->link);
+  publishers = __bcast_leave_tail(bcast, sub->cursor);
+
+  lock_release(&bcast->_chan.lock);
+  __bcast_wakeup(publishers);
+  TSC_SIGNAL_UNMASK();
+
+  TSC_DEALLOC(sub);
+  coroc_refcnt_put(bcast);
+}
+
+int _coroc_bcast_publish(coroc_bcast_t bcast, void *buf, bool block) {
+  coroc_chan_t chan = (coroc_chan_t)bcast;
+  queue_item_t *subscribers = NULL;
+  int ret = CHAN_SUCCESS;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&chan->lock);
+
+  for (;;) {
+    if (chan->close) {
+      ret = CHAN_CLOSED;
+      goto __exit_publish;
+    }
+
+    // nobody listens, just drop it ..
+    if (bcast->subs.status == 0) {
+      bcast->tail = ++(bcast->head);
+      goto __exit_publish;
+    }
+
+    if (bcast->policy == TSC_BCAST_OVERWRITE ||
+        bcast->head - bcast->tail < bcast->bufsize)
+      break;
+
+    // the ring is full now ..
+    if (bcast->policy == TSC_BCAST_DROP) {
+      bcast->dropped++;
+      ret = CHAN_BUSY;
+      goto __exit_publish;
+    }
+
+    if (!block) {
+      ret = CHAN_BUSY;
+      goto __exit_publish;
+    }
+
+    __bcast_wait(bcast, &chan->send_que);
+  }
+
+  // copy the element into the ring only once ..
+  uint8_t *p = bcast->buf;
+  p += (chan->elemsize) * (bcast->head % bcast->bufsize);
+  __chan_memcpy(p, buf, chan->elemsize);
+  bcast->head++;
+
+  subscribers = __bcast_detach(&chan->recv_que);
+
+__exit_publish:
+  lock_release(&chan->lock);
+
+  // wakeup all the blocked subscribers in one batch ..
+  __bcast_wakeup(subscribers);
+
+  TSC_SIGNAL_UNMASK();
+  return ret;
+}
+
+int _coroc_bcast_recv(coroc_bcast_sub_t sub, void *buf, bool block) {
+  coroc_bcast_t bcast = sub->bcast;
+  coroc_chan_t chan = (coroc_chan_t)bcast;
+  queue_item_t *publishers = NULL;
+  int ret = CHAN_SUCCESS;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&chan->lock);
+
+  for (;;) {
+    // skip the elements overwritten by the publisher ..
+    if (bcast->policy == TSC_BCAST_OVERWRITE &&
+        bcast->head - sub->cursor > bcast->bufsize) {
+      sub->lagged += bcast->head - bcast->bufsize - sub->cursor;
+      sub->cursor = bcast->head - bcast->bufsize;
+    }
+
+    if (sub->cursor < bcast->head) {
+      uint8_t *p = bcast->buf;
+      p += (chan->elemsize) * (sub->cursor % bcast->bufsize);
+      __chan_memcpy(buf, p, chan->elemsize);
+      publishers = __bcast_leave_tail(bcast, sub->cursor++);
+      break;
+    }
+
+    if (chan->close) {
+      ret = CHAN_CLOSED;
+      break;
+    }
+
+    if (!block) {
+      ret = CHAN_BUSY;
+      break;
+    }
+
+    __bcast_wait(bcast, &chan->recv_que);
+  }
+
+  lock_release(&chan->lock);
+  __bcast_wakeup(publishers);
+
+  TSC_SIGNAL_UNMASK();
+  return ret;
+}
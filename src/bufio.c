@@ -0,0 +1,251 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "netpoll.h"
+#include "coroc_bufio.h"
+
+coroc_bufio_t coroc_bufio_open(int fd, int size) {
+  coroc_bufio_t bufio = TSC_ALLOC(sizeof(struct coroc_bufio));
+
+  bufio->fd = fd;
+  bufio->size = (size > 0) ? size : TSC_BUFIO_DEFAULT_SIZE;
+  bufio->usec = 0;
+  bufio->error = 0;
+  bufio->eof = false;
+  bufio->rbuf = bufio->wbuf = NULL;
+  bufio->rstart = bufio->rend = bufio->wlen = 0;
+
+  return bufio;
+}
+
+int coroc_bufio_free(coroc_bufio_t bufio) {
+  int ret = coroc_bufio_flush(bufio);
+
+  if (bufio->rbuf != NULL) coroc_slab_free(bufio->rbuf);
+  if (bufio->wbuf != NULL) coroc_slab_free(bufio->wbuf);
+  TSC_DEALLOC(bufio);
+
+  return ret;
+}
+
+void coroc_bufio_set_timeout(coroc_bufio_t bufio, int64_t usec) {
+  bufio->usec = usec;
+}
+
+static inline int __coroc_bufio_fail(coroc_bufio_t bufio) {
+  errno = bufio->error;
+  return -1;
+}
+
+// write all the vectors, wait for the fd if it is full ..
+static int __coroc_bufio_writev(coroc_bufio_t bufio, struct iovec *iov,
+                                int cnt) {
+  ssize_t m;
+
+  while (cnt > 0) {
+    if ((m = writev(bufio->fd, iov, cnt)) < 0) {
+      if (errno != EAGAIN) {
+        bufio->error = errno;
+        return -1;
+      }
+
+      if (bufio->usec <= 0) {
+        coroc_net_wait(bufio->fd, TSC_NETPOLL_WRITE);
+      } else if (!coroc_net_timedwait(bufio->fd, TSC_NETPOLL_WRITE,
+                                      bufio->usec)) {
+        bufio->error = ETIMEDOUT;
+        return -1;
+      }
+      continue;
+    }
+
+    // skip the vectors written ..
+    while (cnt > 0 && m >= (ssize_t)iov->iov_len) {
+      m -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + m;
+      iov->iov_len -= m;
+    }
+  }
+
+  return 0;
+}
+
+int coroc_bufio_flush(coroc_bufio_t bufio) {
+  struct iovec iov;
+
+  if (bufio->wlen == 0) return 0;
+  if (bufio->error != 0) return __coroc_bufio_fail(bufio);
+
+  iov.iov_base = bufio->wbuf;
+  iov.iov_len = bufio->wlen;
+  if (__coroc_bufio_writev(bufio, &iov, 1) < 0)
+    return __coroc_bufio_fail(bufio);
+
+  bufio->wlen = 0;
+  return 0;
+}
+
+int coroc_bufio_write(coroc_bufio_t bufio, const void *buf, int n) {
+  struct iovec iov[2];
+
+  if (bufio->error != 0) return __coroc_bufio_fail(bufio);
+
+  if (bufio->wlen + n <= bufio->size) {
+    if (bufio->wbuf == NULL) bufio->wbuf = coroc_slab_alloc(bufio->size);
+    memcpy(bufio->wbuf + bufio->wlen, buf, n);
+    bufio->wlen += n;
+    return n;
+  }
+
+  // the buffer is full, so write it out with the new data ..
+  iov[0].iov_base = bufio->wbuf;
+  iov[0].iov_len = bufio->wlen;
+  iov[1].iov_base = (void *)buf;
+  iov[1].iov_len = n;
+  if (__coroc_bufio_writev(bufio, (bufio->wlen > 0) ? iov : iov + 1,
+                           (bufio->wlen > 0) ? 2 : 1) < 0)
+    return __coroc_bufio_fail(bufio);
+
+  bufio->wlen = 0;
+  return n;
+}
+
+// one read from the fd, flush the pending writes before it may block ..
+static int __coroc_bufio_recv(coroc_bufio_t bufio, void *buf, int n) {
+  int m;
+
+  if (coroc_bufio_flush(bufio) < 0) return -1;
+
+  if ((m = coroc_net_timed_read(bufio->fd, buf, n, bufio->usec)) < 0)
+    bufio->error = (errno != 0 && errno != EAGAIN) ? errno : ETIMEDOUT;
+  else if (m == 0)
+    bufio->eof = true;
+
+  return m;
+}
+
+// read more data into the buffer, return false on EOF or errors ..
+static bool __coroc_bufio_fill(coroc_bufio_t bufio) {
+  int m;
+
+  if (bufio->eof || bufio->error != 0) return false;
+
+  if (bufio->rbuf == NULL) bufio->rbuf = coroc_slab_alloc(bufio->size);
+
+  // move the unread data to the front ..
+  if (bufio->rstart > 0) {
+    memmove(bufio->rbuf, bufio->rbuf + bufio->rstart,
+            bufio->rend - bufio->rstart);
+    bufio->rend -= bufio->rstart;
+    bufio->rstart = 0;
+  }
+
+  if (bufio->rend == bufio->size) return true;
+
+  m = __coroc_bufio_recv(bufio, bufio->rbuf + bufio->rend,
+                         bufio->size - bufio->rend);
+  if (m <= 0) return false;
+
+  bufio->rend += m;
+  return true;
+}
+
+static inline int __coroc_bufio_done(coroc_bufio_t bufio) {
+  return (bufio->error != 0) ? __coroc_bufio_fail(bufio) : 0;
+}
+
+int coroc_bufio_peek(coroc_bufio_t bufio, const char **data, int n) {
+  if (n > bufio->size) n = bufio->size;
+
+  while (bufio->rend - bufio->rstart < n)
+    if (!__coroc_bufio_fill(bufio)) break;
+
+  if (bufio->rend == bufio->rstart) return __coroc_bufio_done(bufio);
+
+  *data = bufio->rbuf + bufio->rstart;
+  return (bufio->rend - bufio->rstart < n) ? bufio->rend - bufio->rstart : n;
+}
+
+void coroc_bufio_skip(coroc_bufio_t bufio, int n) {
+  assert(n <= bufio->rend - bufio->rstart);
+  bufio->rstart += n;
+}
+
+int coroc_bufio_read(coroc_bufio_t bufio, void *buf, int n) {
+  int avail = bufio->rend - bufio->rstart;
+
+  if (avail == 0) {
+    // read into the caller's buffer directly if it's not smaller ..
+    if (n >= bufio->size) {
+      if (bufio->eof || bufio->error != 0) return __coroc_bufio_done(bufio);
+      return __coroc_bufio_recv(bufio, buf, n);
+    }
+
+    if (!__coroc_bufio_fill(bufio)) return __coroc_bufio_done(bufio);
+    avail = bufio->rend - bufio->rstart;
+  }
+
+  if (n > avail) n = avail;
+  memcpy(buf, bufio->rbuf + bufio->rstart, n);
+  bufio->rstart += n;
+
+  return n;
+}
+
+int coroc_bufio_read_full(coroc_bufio_t bufio, void *buf, int n) {
+  int m, total;
+
+  for (total = 0; total < n; total += m) {
+    m = coroc_bufio_read(bufio, (char *)buf + total, n - total);
+    if (m < 0) return m;
+    if (m == 0) break;
+  }
+
+  return total;
+}
+
+int coroc_bufio_read_until(coroc_bufio_t bufio, int delim, char *buf, int n) {
+  int scanned = 0, avail;
+  char *p;
+
+  if (n > bufio->size) n = bufio->size;
+
+  for (;;) {
+    avail = bufio->rend - bufio->rstart;
+    if (avail > n) avail = n;
+
+    // only scan the bytes not scanned before ..
+    p = (avail > scanned) ? memchr(bufio->rbuf + bufio->rstart + scanned,
+                                   delim, avail - scanned)
+                          : NULL;
+    if (p != NULL) {
+      n = p - (bufio->rbuf + bufio->rstart) + 1;
+      break;
+    }
+
+    scanned = avail;
+    if (avail == n) break;
+
+    if (!__coroc_bufio_fill(bufio)) {
+      if (avail == 0) return __coroc_bufio_done(bufio);
+      n = avail;
+      break;
+    }
+  }
+
+  memcpy(buf, bufio->rbuf + bufio->rstart, n);
+  bufio->rstart += n;
+
+  return n;
+}
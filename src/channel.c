@@ -9,6 +9,8 @@
 #include "channel.h"
 #include "vpu.h"
 #include "coroutine.h"
+#include "coroc_slab.h"
+#include "coroc_time.h"
 
 TSC_SIGNAL_MASK_DECLARE
 
@@ -53,7 +55,11 @@ bool __coroc_copy_from_buff(coroc_chan_t chan, void *buf) {
   if (bchan->nbuf > 0) {
     uint8_t *p = bchan->buf;
     p += (chan->elemsize) * (bchan->recvx++);
-    __chan_memcpy(buf, p, chan->elemsize);
+    // the handle dropped by the receiver must be released here
+    if (buf == NULL && chan->ismove)
+      coroc_refcnt_put(*((coroc_refcnt_t*)p));
+    else
+      __chan_memcpy(buf, p, chan->elemsize);
     (bchan->recvx) %= (bchan->bufsize);
     bchan->nbuf--;
     return true;
@@ -61,22 +67,217 @@ bool __coroc_copy_from_buff(coroc_chan_t chan, void *buf) {
   return false;
 }
 
-void __coroc_clean_buff(coroc_chan_t chan) {
-  coroc_buffered_chan_t bchan = (coroc_buffered_chan_t)chan;
+static bool __coroc_copy_to_segs(coroc_chan_t chan, void *buf) {
+  coroc_unbounded_chan_t uchan = (coroc_unbounded_chan_t)chan;
+  coroc_chan_seg_t *seg = uchan->tail;
+
+  // link a new segment if the last one is full ..
+  if (seg == NULL || seg->sendx == uchan->segsize) {
+    seg = coroc_slab_alloc(sizeof(coroc_chan_seg_t) +
+                           (chan->elemsize) * (uchan->segsize));
+    seg->next = NULL;
+    seg->recvx = seg->sendx = 0;
+
+    if (uchan->tail != NULL)
+      uchan->tail->next = seg;
+    else
+      uchan->head = seg;
+    uchan->tail = seg;
+  }
 
-  while (bchan->nbuf > 0) {
-    uint8_t *p = bchan->buf;
-    p += (chan->elemsize) * (bchan->recvx++);
+  uint8_t *p = seg->buf;
+  p += (chan->elemsize) * (seg->sendx++);
+  __chan_memcpy(p, buf, chan->elemsize);
+
+  if (++(uchan->nbuf) > uchan->watermark && 
+      uchan->notify != NULL && !(uchan->overflow)) {
+    uchan->overflow = true;
+    uchan->notify(chan, uchan->nbuf);
+  }
+
+  return true;
+}
+
+static bool __coroc_copy_from_segs(coroc_chan_t chan, void *buf) {
+  coroc_unbounded_chan_t uchan = (coroc_unbounded_chan_t)chan;
+  coroc_chan_seg_t *seg = uchan->head;
+
+  if (uchan->nbuf == 0) return false;
+
+  uint8_t *p = seg->buf;
+  p += (chan->elemsize) * (seg->recvx++);
+  // the handle dropped by the receiver must be released here
+  if (buf == NULL && chan->ismove)
     coroc_refcnt_put(*((coroc_refcnt_t*)p));
-    (bchan->recvx) %= (bchan->bufsize);
-    bchan->nbuf--;
+  else
+    __chan_memcpy(buf, p, chan->elemsize);
+
+  if (seg->recvx == seg->sendx) {
+    if (seg == uchan->tail) {
+      // reuse the last segment ..
+      seg->recvx = seg->sendx = 0;
+    } else {
+      uchan->head = seg->next;
+      coroc_slab_free(seg);
+    }
   }
+
+  if (--(uchan->nbuf) <= uchan->watermark) uchan->overflow = false;
+
+  return true;
+}
+
+static void __coroc_free_segs(coroc_chan_t chan) {
+  coroc_unbounded_chan_t uchan = (coroc_unbounded_chan_t)chan;
+  coroc_chan_seg_t *seg = uchan->head;
+
+  while (seg != NULL) {
+    coroc_chan_seg_t *next = seg->next;
+    coroc_slab_free(seg);
+    seg = next;
+  }
+
+  uchan->head = uchan->tail = NULL;
+  uchan->nbuf = 0;
+}
+
+static inline bool __prio_before(coroc_prio_entry_t *e0,
+                                 coroc_prio_entry_t *e1) {
+  return (e0->prio > e1->prio) || (e0->prio == e1->prio && e0->seq < e1->seq);
+}
+
+static bool __coroc_copy_to_heap(coroc_chan_t chan, void *buf) {
+  coroc_prio_chan_t pchan = (coroc_prio_chan_t)chan;
+  coroc_prio_entry_t *heap = pchan->heap;
+
+  if (pchan->nbuf == pchan->bufsize) return false;
+
+  coroc_prio_entry_t e;
+  e.prio = pchan->prio(buf);
+  e.seq = pchan->seq++;
+  e.slot = pchan->slots[pchan->nbuf];
+  __chan_memcpy(pchan->buf + (chan->elemsize) * e.slot, buf, chan->elemsize);
+
+  // sift up ..
+  int32_t cur = pchan->nbuf++;
+  while (cur > 0) {
+    int32_t parent = (cur - 1) >> 1;
+    if (!__prio_before(&e, &heap[parent])) break;
+    heap[cur] = heap[parent];
+    cur = parent;
+  }
+  heap[cur] = e;
+
+  return true;
+}
+
+static bool __coroc_copy_from_heap(coroc_chan_t chan, void *buf) {
+  coroc_prio_chan_t pchan = (coroc_prio_chan_t)chan;
+  coroc_prio_entry_t *heap = pchan->heap;
+
+  if (pchan->nbuf == 0) return false;
+
+  int32_t slot = heap[0].slot;
+  __chan_memcpy(buf, pchan->buf + (chan->elemsize) * slot, chan->elemsize);
+
+  int32_t size = --(pchan->nbuf);
+  pchan->slots[size] = slot;
+
+  // sift down the last one from the top ..
+  coroc_prio_entry_t e = heap[size];
+  int32_t cur = 0;
+  for (;;) {
+    int32_t child = (cur << 1) + 1;
+    if (child >= size) break;
+    if (child + 1 < size && __prio_before(&heap[child + 1], &heap[child]))
+      child++;
+    if (!__prio_before(&heap[child], &e)) break;
+    heap[cur] = heap[child];
+    cur = child;
+  }
+  heap[cur] = e;
+
+  return true;
+}
+
+// release all the auto-refcnt elements in the buffer
+void __coroc_clean_buff(coroc_chan_t chan) {
+  coroc_refcnt_t ref;
+  while (chan->copy_from_buff(chan, &ref)) coroc_refcnt_put(ref);
+}
+
+coroc_chan_t _coroc_unbounded_chan_allocate(int32_t elemsize, bool isref) {
+  coroc_unbounded_chan_t uchan = TSC_ALLOC(sizeof(struct coroc_unbounded_chan));
+  assert(uchan != NULL);
+
+  coroc_chan_init((coroc_chan_t)uchan, elemsize, isref, __coroc_copy_to_segs,
+                  __coroc_copy_from_segs);
+  uchan->_chan.fini = __coroc_free_segs;
+
+  // fill one segment with as many elements as possible ..
+  int32_t hdr = sizeof(coroc_chan_seg_t) + sizeof(coroc_slab_hdr_t);
+  uchan->segsize = 1;
+  if (elemsize == 0)
+    uchan->segsize = TSC_CHAN_SEG_BYTES;
+  else if (elemsize < TSC_CHAN_SEG_BYTES - hdr)
+    uchan->segsize = (TSC_CHAN_SEG_BYTES - hdr) / elemsize;
+
+  uchan->overflow = false;
+  uchan->nbuf = 0;
+  uchan->watermark = 0;
+  uchan->notify = NULL;
+  uchan->head = uchan->tail = NULL;
+
+  return (coroc_chan_t)uchan;
+}
+
+coroc_chan_t coroc_prio_chan_allocate(int32_t elemsize, int32_t bufsize,
+                                      coroc_chan_prio_fn prio) {
+  assert(bufsize > 0 && prio != NULL);
+
+  coroc_prio_chan_t pchan =
+      TSC_ALLOC(sizeof(struct coroc_prio_chan) +
+                bufsize * (sizeof(coroc_prio_entry_t) + sizeof(int32_t)) +
+                bufsize * elemsize);
+  assert(pchan != NULL);
+
+  coroc_chan_init((coroc_chan_t)pchan, elemsize, false, __coroc_copy_to_heap,
+                  __coroc_copy_from_heap);
+
+  pchan->bufsize = bufsize;
+  pchan->nbuf = 0;
+  pchan->seq = 0;
+  pchan->prio = prio;
+  pchan->heap = (coroc_prio_entry_t *)(pchan + 1);
+  pchan->slots = (int32_t *)(pchan->heap + bufsize);
+  pchan->buf = (uint8_t *)(pchan->slots + bufsize);
+
+  int32_t i;
+  for (i = 0; i < bufsize; ++i) pchan->slots[i] = i;
+
+  return (coroc_chan_t)pchan;
+}
+
+void coroc_chan_set_watermark(coroc_chan_t chan, int64_t watermark,
+                              coroc_chan_watermark_t notify) {
+  coroc_unbounded_chan_t uchan = (coroc_unbounded_chan_t)chan;
+  assert(chan->copy_to_buff == __coroc_copy_to_segs);
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&chan->lock);
+  uchan->watermark = watermark;
+  uchan->notify = notify;
+  uchan->overflow = (uchan->nbuf > watermark);
+  lock_release(&chan->lock);
+  TSC_SIGNAL_UNMASK();
 }
 
 coroc_chan_t _coroc_chan_allocate(int32_t elemsize, int32_t bufsize, bool isref) {
   struct coroc_chan *chan;
   bool _isref = (bufsize > 0) && isref; // if no buffer, we don't handle the refcnt types!!
 
+  if (bufsize < 0) return _coroc_unbounded_chan_allocate(elemsize, isref);
+
   if (bufsize > 0) {
     coroc_buffered_chan_t bchan =
         TSC_ALLOC(sizeof(struct coroc_buffered_chan) + elemsize * bufsize);
@@ -91,9 +292,16 @@ coroc_chan_t _coroc_chan_allocate(int32_t elemsize, int32_t bufsize, bool isref)
   return chan;
 }
 
+coroc_chan_t _coroc_move_chan_allocate(int32_t bufsize) {
+  coroc_chan_t chan = _coroc_chan_allocate(sizeof(coroc_refcnt_t), bufsize, true);
+  chan->ismove = 1;
+  return chan;
+}
+
 void _coroc_chan_dealloc(coroc_chan_t chan) {
   /* TODO: awaken the sleeping coroutines */
   coroc_chan_close(chan);
+  if (chan->fini) chan->fini(chan);
   lock_fini(&chan->lock);
   TSC_DEALLOC(chan);
 }
@@ -109,13 +317,139 @@ static quantum *fetch_quantum(queue_t *queue) {
   return q;
 }
 
-static int __coroc_chan_send(coroc_chan_t chan, void *buf, bool block) {
+// copy one element from the sender to the receiver,
+// a handle of the move channel dropped by the receiver is released here.
+static inline void __coroc_chan_copy(coroc_chan_t chan, void *dst, void *src) {
+  if (chan->copy) {
+    chan->copy(chan, dst, src);
+    return;
+  }
+  if (chan->ismove && dst == NULL) {
+    if (src != NULL) coroc_refcnt_put(*((coroc_refcnt_t*)src));
+    return;
+  }
+  __chan_memcpy(dst, src, chan->elemsize);
+}
+
+// the sender gives away the ownership of the handle after a successful send,
+// so reset its handle to avoid touching the buffer again ..
+static inline void __coroc_chan_give(coroc_chan_t chan, void *buf) {
+  if (chan->ismove && buf != NULL) *((coroc_refcnt_t*)buf) = NULL;
+}
+
+// the deadline of a timed wait, embedded in the waiter's stack,
+// so a timed wait allocates nothing ..
+typedef struct chan_deadline {
+  coroc_inter_timer_t timer;
+  coroc_coroutine_t coroutine;
+  lock_t lock;  // the last lock released by the waiter before suspending
+} chan_deadline;
+
+// called by the VPU schedulers with the timer shard's lock held,
+// so never wait for the channel's lock here, or a deadlock may happen
+// with the waiter who is adding its timer with the channel's lock held.
+static void __coroc_chan_timeout(void *arg) {
+  chan_deadline *dl = (chan_deadline *)arg;
+
+  if (lock_try_acquire(dl->lock) != 0) {
+    // the waiter is still suspending or others are using the channel,
+    // so re-arm the timer and try again ..
+    coroc_intertimer_retry(&dl->timer);
+    return;
+  }
+
+  // compete with the other side of the channel like the select does,
+  // the winner wakes the waiter up ..
+  bool succ = TSC_CAS(&dl->coroutine->qtag, NULL, dl);
+  lock_release(dl->lock);
+
+  if (succ) vpu_ready(dl->coroutine, false);
+}
+
+static inline void __coroc_chan_deadline_init(chan_deadline *dl,
+                                              coroc_coroutine_t self,
+                                              lock_t lock, int64_t usec) {
+  dl->timer.when = coroc_getcachedtime() + usec;
+  dl->timer.period = 0;
+  dl->timer.slack = coroc_timer_slack;
+  dl->timer.func = __coroc_chan_timeout;
+  dl->timer.args = NULL;
+  dl->timer.owner = NULL;
+  dl->coroutine = self;
+  dl->lock = lock;
+}
+
+static inline bool __coroc_chan_recheck(coroc_chan_t chan, void *buf) {
+  if (!chan->isasync) return false;
+  TSC_SYNC_ALL();
+  return chan->copy_from_buff(chan, buf);
+}
+
+// block the current coroutine on the given quantum, must hold the lock,
+// return false if the deadline reached before any others fetch the quantum.
+static bool __coroc_chan_suspend(coroc_chan_t chan, queue_t *que, quantum *q,
+                                 int64_t usec) {
+  chan_deadline dl;
+  bool timeout = false;
+
+  if (usec > 0) {
+    // the timed quantum will be fetched like the select's ..
+    q->select = true;
+    q->coroutine->qtag = NULL;
+    __coroc_chan_deadline_init(&dl, q->coroutine, &chan->lock, usec);
+  }
+
+  queue_add(que, &q->link);
+
+  // the senders of an async channel push without the lock,
+  // so check the buffer again after the quantum is visible to them ..
+  if (que == &chan->recv_que && __coroc_chan_recheck(chan, q->itembuf)) {
+    queue_extract(que, &q->link);
+    q->coroutine->qtag = NULL;
+    return true;
+  }
+
+  // armed with the channel's lock held, so none of the timer callbacks
+  // may wait for a channel's lock, even the tickers send after the expiry ..
+  if (usec > 0) coroc_add_intertimer(&dl.timer);
+
+  vpu_suspend(&chan->lock, (unlock_handler_t)(lock_release));
+
+  if (usec > 0) {
+    // the timer must be deleted before touching the qtag again ..
+    coroc_del_intertimer(&dl.timer);
+    lock_acquire(&chan->lock);
+
+    timeout = (q->coroutine->qtag == &dl);
+    q->coroutine->qtag = NULL;
+    if (timeout) queue_extract(que, &q->link);
+  } else {
+    lock_acquire(&chan->lock);
+  }
+
+  TSC_SYNC_ALL();
+  return !timeout;
+}
+
+bool __coroc_chan_wakeup_recv(coroc_chan_t chan) {
+  quantum *qp = fetch_quantum(&chan->recv_que);
+  if (qp == NULL) return false;
+
+  bool succ = chan->copy_from_buff(chan, qp->itembuf);
+  assert(succ);
+  vpu_ready(qp->coroutine, false);
+  return true;
+}
+
+static int __coroc_chan_send(coroc_chan_t chan, void *buf, bool block,
+                             int64_t usec) {
   coroc_coroutine_t self = coroc_coroutine_self();
 
   // check if there're any waiting coroutines ..
   quantum *qp = fetch_quantum(&chan->recv_que);
   if (qp != NULL) {
-    __chan_memcpy(qp->itembuf, buf, chan->elemsize);
+    __coroc_chan_copy(chan, qp->itembuf, buf);
+    __coroc_chan_give(chan, buf);
     vpu_ready(qp->coroutine, false);
     return CHAN_SUCCESS;
   }
@@ -124,36 +458,47 @@ static int __coroc_chan_send(coroc_chan_t chan, void *buf, bool block) {
   if (chan->close) return CHAN_CLOSED;
 
   // check if there're any buffer slots ..
-  if (chan->copy_to_buff && chan->copy_to_buff(chan, buf)) return CHAN_SUCCESS;
+  if (chan->copy_to_buff && chan->copy_to_buff(chan, buf)) {
+    __coroc_chan_give(chan, buf);
+    return CHAN_SUCCESS;
+  }
 
   // block or return CHAN_BUSY ..
   if (block) {
     // the async way ..
     quantum q;
     quantum_init(&q, chan, self, buf, false);
-    queue_add(&chan->send_que, &q.link);
-    vpu_suspend(&chan->lock, (unlock_handler_t)(lock_release));
     // awaken by a receiver later ..
-    lock_acquire(&chan->lock);
-    TSC_SYNC_ALL();
+    if (!__coroc_chan_suspend(chan, &chan->send_que, &q, usec))
+      return CHAN_TIMEOUT;
     if (q.close) return CHAN_CLOSED;
+    __coroc_chan_give(chan, buf);
     return CHAN_AWAKEN;
   }
 
   return CHAN_BUSY;
 }
 
-static int __coroc_chan_recv(coroc_chan_t chan, void *buf, bool block) {
+static int __coroc_chan_recv(coroc_chan_t chan, void *buf, bool block,
+                             int64_t usec) {
   coroc_coroutine_t self = coroc_coroutine_self();
 
   // check if there're any empty slots ..
-  if (chan->copy_from_buff && chan->copy_from_buff(chan, buf))
+  if (chan->copy_from_buff && chan->copy_from_buff(chan, buf)) {
+    // move one pending sender into the free slot,
+    // so its element will be ordered with the buffered ones ..
+    quantum *qp = fetch_quantum(&chan->send_que);
+    if (qp != NULL) {
+      chan->copy_to_buff(chan, qp->itembuf);
+      vpu_ready(qp->coroutine, false);
+    }
     return CHAN_SUCCESS;
+  }
 
   // check if there're any senders pending .
   quantum *qp = fetch_quantum(&chan->send_que);
   if (qp != NULL) {
-    __chan_memcpy(buf, qp->itembuf, chan->elemsize);
+    __coroc_chan_copy(chan, buf, qp->itembuf);
     vpu_ready(qp->coroutine, false);
     return CHAN_SUCCESS;
   }
@@ -166,11 +511,9 @@ static int __coroc_chan_recv(coroc_chan_t chan, void *buf, bool block) {
     // async way ..
     quantum q;
     quantum_init(&q, chan, self, buf, false);
-    queue_add(&chan->recv_que, &q.link);
-    vpu_suspend(&chan->lock, (unlock_handler_t)(lock_release));
     // awaken by a sender later ..
-    lock_acquire(&chan->lock);
-    TSC_SYNC_ALL();
+    if (!__coroc_chan_suspend(chan, &chan->recv_que, &q, usec))
+      return CHAN_TIMEOUT;
 
     if (q.close) return CHAN_CLOSED;
     return CHAN_AWAKEN;
@@ -185,7 +528,19 @@ int _coroc_chan_send(coroc_chan_t chan, void *buf, bool block) {
 
   int ret;
   lock_acquire(&chan->lock);
-  ret = __coroc_chan_send(chan, buf, block);
+  ret = __coroc_chan_send(chan, buf, block, 0);
+  lock_release(&chan->lock);
+
+  TSC_SIGNAL_UNMASK();
+  return ret;
+}
+
+int coroc_chan_send_timeout(coroc_chan_t chan, void *buf, int64_t usec) {
+  TSC_SIGNAL_MASK();
+
+  int ret;
+  lock_acquire(&chan->lock);
+  ret = __coroc_chan_send(chan, buf, usec > 0, usec);
   lock_release(&chan->lock);
 
   TSC_SIGNAL_UNMASK();
@@ -199,7 +554,20 @@ int _coroc_chan_recv(coroc_chan_t chan, void *buf, bool block) {
   // if the `chan' is nil, start the message passing mode..
   if (chan == NULL) chan = (coroc_chan_t)coroc_coroutine_self();
   lock_acquire(&chan->lock);
-  ret = __coroc_chan_recv(chan, buf, block);
+  ret = __coroc_chan_recv(chan, buf, block, 0);
+  lock_release(&chan->lock);
+
+  TSC_SIGNAL_UNMASK();
+  return ret;
+}
+
+int coroc_chan_recv_timeout(coroc_chan_t chan, void *buf, int64_t usec) {
+  TSC_SIGNAL_MASK();
+  int ret;
+
+  if (chan == NULL) chan = (coroc_chan_t)coroc_coroutine_self();
+  lock_acquire(&chan->lock);
+  ret = __coroc_chan_recv(chan, buf, usec > 0, usec);
   lock_release(&chan->lock);
 
   TSC_SIGNAL_UNMASK();
@@ -280,7 +648,11 @@ void coroc_chan_set_recv(coroc_chan_set_t set, coroc_chan_t chan, void *buf) {
   assert(set != NULL);
   assert(set->size < set->volume);
   // if the `chan' is nil, start the message-passing mode ..
-  if (chan == NULL) chan = (coroc_chan_t)coroc_coroutine_self();
+  if (chan == NULL) {
+    chan = (coroc_chan_t)coroc_coroutine_self();
+    // the select always gets the payload's pointer ..
+    if (buf != NULL) ((coroc_msg_t *)buf)->mode = TSC_MSG_OWNED;
+  }
 
   int i = set->size++;
   coroc_scase_t *scase = &(set->cases[i]);
@@ -293,7 +665,8 @@ void coroc_chan_set_recv(coroc_chan_set_t set, coroc_chan_t chan, void *buf) {
   chan->select = true;
 }
 
-int _coroc_chan_set_select(coroc_chan_set_t set, bool block, coroc_chan_t *active) {
+int _coroc_chan_set_select(coroc_chan_set_t set, bool block, int64_t usec,
+                           coroc_chan_t *active) {
   assert(set != NULL);
   TSC_SIGNAL_MASK();
 
@@ -315,10 +688,10 @@ int _coroc_chan_set_select(coroc_chan_set_t set, bool block, coroc_chan_t *activ
 
     switch (e->type) {
       case CHAN_SEND:
-        ret = __coroc_chan_send(e->chan, e->buf, false);
+        ret = __coroc_chan_send(e->chan, e->buf, false, 0);
         break;
       case CHAN_RECV:
-        ret = __coroc_chan_recv(e->chan, e->buf, false);
+        ret = __coroc_chan_recv(e->chan, e->buf, false, 0);
     }
     if (ret == CHAN_SUCCESS) {
       *active = e->chan;
@@ -331,7 +704,11 @@ int _coroc_chan_set_select(coroc_chan_set_t set, bool block, coroc_chan_t *activ
   if (block) {
     // TODO : add quantums ..
     self->qtag = NULL;
-    quantum *qarray = TSC_ALLOC((set->size) * sizeof(quantum));
+    // small sets keep their quantums on the stack ..
+    quantum qstack[TSC_LOCKCHAIN_DEFAULT_VOLUME];
+    quantum *qarray = qstack;
+    if (set->size > TSC_LOCKCHAIN_DEFAULT_VOLUME)
+      qarray = TSC_ALLOC((set->size) * sizeof(quantum));
     quantum *pq = qarray;
 
     for (i = 0; i < set->size; i++) {
@@ -348,13 +725,36 @@ int _coroc_chan_set_select(coroc_chan_set_t set, bool block, coroc_chan_t *activ
       pq++;
     }
 
-    vpu_suspend(set, (unlock_handler_t)lock_chain_release);
-    lock_chain_acquire((lock_chain_t *)set);
+    for (i = 0; i < set->size; i++) {
+      coroc_scase_t *e = &set->cases[i];
+      if (e->type == CHAN_RECV && __coroc_chan_recheck(e->chan, e->buf)) {
+        self->qtag = e->chan;
+        break;
+      }
+    }
+
+    // the chain is sorted now, so the first lock will be released last ..
+    chan_deadline dl;
+    if (self->qtag == NULL) {
+      if (usec > 0) {
+        __coroc_chan_deadline_init(&dl, self, set->locks[0], usec);
+        coroc_add_intertimer(&dl.timer);
+      }
+
+      vpu_suspend(set, (unlock_handler_t)lock_chain_release);
+      if (usec > 0) coroc_del_intertimer(&dl.timer);
+      lock_chain_acquire((lock_chain_t *)set);
+    }
 
     // get the selected one
     *active = (coroc_chan_t)(self->qtag);
     ret = CHAN_SUCCESS;
 
+    if (usec > 0 && self->qtag == &dl) {
+      *active = NULL;
+      ret = CHAN_TIMEOUT;
+    }
+
     // dequeue all unactive chans ..
     pq = qarray;
 
@@ -364,16 +764,21 @@ int _coroc_chan_set_select(coroc_chan_set_t set, bool block, coroc_chan_t *activ
       if (e->type == CHAN_RECV) que = &(e->chan->recv_que);
 
       // check if the selected one is closed ..
-      if ((*active == pq->chan) && pq->close) ret = CHAN_CLOSED;
+      if (*active == pq->chan) {
+        if (pq->close)
+          ret = CHAN_CLOSED;
+        else if (e->type == CHAN_SEND)
+          __coroc_chan_give(e->chan, e->buf);
+      }
 
       queue_extract(que, &pq->link);
       pq++;
     }
 
     // relase the quantums , safe ?
-    TSC_DEALLOC(qarray);
+    if (qarray != qstack) TSC_DEALLOC(qarray);
 
-    *active = (coroc_chan_t)(self->qtag);
+    if (ret != CHAN_TIMEOUT) *active = (coroc_chan_t)(self->qtag);
     self->qtag = NULL;
   }
 
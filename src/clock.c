@@ -10,7 +10,7 @@
 
 #define TSC_CLOCK_PERIOD_NANOSEC 500000  // 0.5 ms per signal
 
-extern bool __coroc_netpoll_polling(bool);
+extern bool __coroc_netpoll_polling(int, int);
 
 clock_manager_t clock_manager;
 
@@ -110,7 +110,7 @@ void clock_routine(void) {
     for (; index < vpu_manager.xt_index; ++index) {
       TSC_OS_THREAD_SENDSIG(vpu_manager.vpu[index].os_thr, TSC_CLOCK_SIGNAL);
     }
-    __coroc_netpoll_polling(0);
+    __coroc_netpoll_polling(-1, 0);
 #endif  // ENABLE_TIMESHARE
     
     if (!do_profile) continue;
@@ -65,6 +65,7 @@ coroc_coroutine_t coroc_coroutine_allocate(coroc_coroutine_handler_t entry,
     coroutine->cleanup = cleanup;
     coroutine->syscall = false;
     coroutine->sigmask_nest = 0;
+    coroutine->splice_pipe[0] = coroutine->splice_pipe[1] = -1;
 
     if (type == TSC_COROUTINE_IDLE) {
       coroutine->stack_size = 0;
@@ -124,6 +125,11 @@ void coroc_coroutine_deallocate(coroc_coroutine_t coroutine) {
   }
 #endif
 
+  if (coroutine->splice_pipe[0] >= 0) {
+    close(coroutine->splice_pipe[0]);
+    close(coroutine->splice_pipe[1]);
+  }
+
   coroc_async_chan_fini((coroc_async_chan_t)coroutine);
   coroc_refcnt_put((coroc_refcnt_t)coroutine);
   // TSC_DEALLOC(coroutine);
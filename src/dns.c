@@ -0,0 +1,564 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "vpu.h"
+#include "netpoll.h"
+#include "coroc_hash.h"
+#include "coroc_time.h"
+#include "coroc_dns.h"
+
+#define TSC_DNS_PORT 53
+#define TSC_DNS_MAX_SERVERS 3
+#define TSC_DNS_TRIES 2
+#define TSC_DNS_TIMEOUT 1000000  // usec, of each try
+#define TSC_DNS_UDP_SIZE 512
+#define TSC_DNS_NAME_MAX 253
+#define TSC_DNS_CACHE_MAX 1024
+
+// the TTLs in seconds, the answers' ones are clamped into
+// [MIN, MAX], the hosts and non-existent names use their own ..
+#define TSC_DNS_MIN_TTL 1
+#define TSC_DNS_MAX_TTL 3600
+#define TSC_DNS_HOSTS_TTL 60
+#define TSC_DNS_NEG_TTL 5
+
+TSC_TLS_DECLARE
+TSC_SIGNAL_MASK_DECLARE
+
+enum { TSC_DNS_PENDING, TSC_DNS_DONE };
+
+// the cached answer of a name, refreshed by the first lookup after
+// it expires, the expired or least recently used ones are evicted
+// when the cache is full ..
+typedef struct coroc_dns_entry {
+  char *name;
+  int state;
+  int error;       // 0 or the errno of the last query
+  uint32_t ip;
+  int64_t expire;  // in microseconds
+  queue_t waiters;
+  queue_item_t link;  // in the LRU order
+} coroc_dns_entry_t;
+
+// one coroutine waiting for the query of another, on its stack ..
+typedef struct coroc_dns_wait {
+  coroc_coroutine_t wait;
+  queue_item_t link;
+  int error;
+  uint32_t ip;
+} coroc_dns_wait_t;
+
+static struct {
+  coroc_lock lock;
+  hash_t cache;
+  queue_t lru;  // the least recently used entry first
+  int num;
+  struct sockaddr_in servers[TSC_DNS_MAX_SERVERS];
+  int random;  // the fd of the query IDs' source
+  uint32_t id;
+} __coroc_dns;
+
+static pthread_once_t __coroc_dns_once = PTHREAD_ONCE_INIT;
+
+static void __coroc_dns_init(void) {
+  char line[256], addr[64];
+  struct sockaddr_in *sa;
+  FILE *fp;
+
+  lock_init(&__coroc_dns.lock);
+  hash_init(&__coroc_dns.cache);
+  queue_init(&__coroc_dns.lru);
+  __coroc_dns.num = 0;
+  __coroc_dns.random = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  __coroc_dns.id = (uint32_t)coroc_getnanotime();
+
+  if ((fp = fopen("/etc/resolv.conf", "r")) != NULL) {
+    while (__coroc_dns.num < TSC_DNS_MAX_SERVERS &&
+           fgets(line, sizeof(line), fp) != NULL) {
+      if (sscanf(line, "nameserver %63s", addr) != 1) continue;
+
+      sa = &__coroc_dns.servers[__coroc_dns.num];
+      memset(sa, 0, sizeof(*sa));
+      sa->sin_family = AF_INET;
+      sa->sin_port = htons(TSC_DNS_PORT);
+      if (inet_pton(AF_INET, addr, &sa->sin_addr) == 1) __coroc_dns.num++;
+    }
+    fclose(fp);
+  }
+
+  if (__coroc_dns.num == 0) coroc_dns_set_server("127.0.0.1", TSC_DNS_PORT);
+}
+
+int coroc_dns_set_server(const char *ip, int port) {
+  struct sockaddr_in sa;
+
+  pthread_once(&__coroc_dns_once, __coroc_dns_init);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &sa.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&__coroc_dns.lock);
+  __coroc_dns.servers[0] = sa;
+  __coroc_dns.num = 1;
+  lock_release(&__coroc_dns.lock);
+  TSC_SIGNAL_UNMASK();
+
+  return 0;
+}
+
+static bool __coroc_dns_hosts(const char *name, uint32_t *ip) {
+  char line[512], *tok, *save;
+  struct in_addr addr;
+  bool found = false;
+  FILE *fp;
+
+  if ((fp = fopen("/etc/hosts", "r")) == NULL) return false;
+
+  while (!found && fgets(line, sizeof(line), fp) != NULL) {
+    if ((tok = strchr(line, '#')) != NULL) *tok = '\0';
+    if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL) continue;
+    if (inet_pton(AF_INET, tok, &addr) != 1) continue;
+
+    while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+      if (strcasecmp(tok, name) == 0) {
+        memcpy(ip, &addr, 4);
+        found = true;
+        break;
+      }
+    }
+  }
+
+  fclose(fp);
+  return found;
+}
+
+// build the query of the A record, return its length ..
+static int __coroc_dns_query(uint8_t *buf, const char *name, uint16_t id) {
+  uint8_t *p = buf + 12;
+  const char *s = name, *dot;
+  size_t len;
+
+  memset(buf, 0, 12);
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+  buf[2] = 0x01;  // recursion desired
+  buf[5] = 1;     // one question
+
+  while (*s != '\0') {
+    dot = strchr(s, '.');
+    len = (dot != NULL) ? (size_t)(dot - s) : strlen(s);
+    if (len == 0 || len > 63) return -1;
+
+    *p++ = len;
+    memcpy(p, s, len);
+    p += len;
+    s += len;
+    if (*s == '.') s++;
+  }
+
+  *p++ = 0;
+  *p++ = 0, *p++ = 1;  // type A
+  *p++ = 0, *p++ = 1;  // class IN
+
+  return p - buf;
+}
+
+// skip the name at `off', maybe compressed, return the offset after it ..
+static int __coroc_dns_skip(const uint8_t *msg, int len, int off) {
+  while (off < len) {
+    if (msg[off] == 0) return off + 1;
+    if ((msg[off] & 0xc0) == 0xc0) return off + 2;
+    off += msg[off] + 1;
+  }
+  return -1;
+}
+
+// the question of the answer must be the one of the query `q',
+// the name is compared case-insensitively ..
+static bool __coroc_dns_question(const uint8_t *msg, int len,
+                                 const uint8_t *q, int qlen) {
+  int i;
+
+  if (len < qlen || ((msg[4] << 8) | msg[5]) != 1) return false;
+
+  for (i = 12; i < qlen; i++) {
+    uint8_t a = msg[i], b = q[i];
+    if (a >= 'A' && a <= 'Z') a += 32;
+    if (b >= 'A' && b <= 'Z') b += 32;
+    if (a != b) return false;
+  }
+
+  return true;
+}
+
+// parse the answer of the query `q', return 0 with the first address and
+// the smallest TTL, EBADMSG if it's not the answer of the query, EMSGSIZE
+// if truncated, ENOENT if there is no such name or address, or EIO for
+// other errors ..
+static int __coroc_dns_parse(const uint8_t *msg, int len, const uint8_t *q,
+                             int qlen, uint32_t *ip, uint32_t *ttl) {
+  int an, off = qlen, found = 0;
+
+  if (len < 12 || msg[0] != q[0] || msg[1] != q[1] || !(msg[2] & 0x80))
+    return EBADMSG;
+  if (!__coroc_dns_question(msg, len, q, qlen)) return EBADMSG;
+  if (msg[2] & 0x02) return EMSGSIZE;
+  if ((msg[3] & 0x0f) == 3) return ENOENT;
+  if ((msg[3] & 0x0f) != 0) return EIO;
+
+  an = (msg[6] << 8) | msg[7];
+
+  // the CNAMEs come before the addresses, just take the addresses ..
+  *ttl = TSC_DNS_MAX_TTL;
+  while (an-- > 0) {
+    int type, cls, rdlen;
+    uint32_t t;
+
+    if ((off = __coroc_dns_skip(msg, len, off)) < 0 || off + 10 > len)
+      return EBADMSG;
+
+    type = (msg[off] << 8) | msg[off + 1];
+    cls = (msg[off + 2] << 8) | msg[off + 3];
+    t = ((uint32_t)msg[off + 4] << 24) | (msg[off + 5] << 16) |
+        (msg[off + 6] << 8) | msg[off + 7];
+    rdlen = (msg[off + 8] << 8) | msg[off + 9];
+    off += 10;
+    if (off + rdlen > len) return EBADMSG;
+
+    if (t < *ttl) *ttl = t;
+    if (type == 1 && cls == 1 && rdlen == 4 && !found) {
+      memcpy(ip, msg + off, 4);
+      found = 1;
+    }
+    off += rdlen;
+  }
+
+  return found ? 0 : ENOENT;
+}
+
+static int __coroc_dns_udp(const struct sockaddr_in *sa, const uint8_t *q,
+                           int qlen, uint32_t *ip, uint32_t *ttl) {
+  uint8_t buf[TSC_DNS_UDP_SIZE];
+  int64_t deadline = coroc_getmicrotime() + TSC_DNS_TIMEOUT, left;
+  int fd, n, err;
+
+  if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) return errno;
+  coroc_net_nonblock(fd);
+
+  // connected, so only the server's datagrams come ..
+  if (connect(fd, (const struct sockaddr *)sa, sizeof(*sa)) < 0 ||
+      coroc_net_write(fd, (void *)q, qlen) != qlen) {
+    err = errno;
+    coroc_net_close(fd);
+    return err;
+  }
+
+  for (;;) {
+    if ((left = deadline - coroc_getmicrotime()) <= 0) {
+      err = ETIMEDOUT;
+      break;
+    }
+    if ((n = coroc_net_timed_read(fd, buf, sizeof(buf), left)) < 0) {
+      err = (errno == ECONNREFUSED) ? ECONNREFUSED : ETIMEDOUT;
+      break;
+    }
+    if ((err = __coroc_dns_parse(buf, n, q, qlen, ip, ttl)) != EBADMSG) break;
+  }
+
+  coroc_net_close(fd);
+  return err;
+}
+
+static int __coroc_dns_read(int fd, uint8_t *buf, int n, int64_t deadline) {
+  int m, total;
+  int64_t left;
+
+  for (total = 0; total < n; total += m) {
+    if ((left = deadline - coroc_getmicrotime()) <= 0) return -1;
+    if ((m = coroc_net_timed_read(fd, buf + total, n - total, left)) <= 0)
+      return -1;
+  }
+
+  return total;
+}
+
+// the truncated answer is queried again by TCP ..
+static int __coroc_dns_tcp(const struct sockaddr_in *sa, const uint8_t *q,
+                           int qlen, uint32_t *ip, uint32_t *ttl) {
+  int64_t deadline = coroc_getmicrotime() + TSC_DNS_TIMEOUT;
+  uint8_t hdr[2] = {qlen >> 8, qlen & 0xff}, *msg;
+  struct iovec iov[2];
+  char host[INET_ADDRSTRLEN];
+  int fd, len, err;
+
+  inet_ntop(AF_INET, &sa->sin_addr, host, sizeof(host));
+  if ((fd = coroc_net_timed_dial(true, host, ntohs(sa->sin_port),
+                                 TSC_DNS_TIMEOUT)) < 0)
+    return (errno != 0) ? errno : ETIMEDOUT;
+
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = 2;
+  iov[1].iov_base = (void *)q;
+  iov[1].iov_len = qlen;
+  if (coroc_net_writev(fd, iov, 2) != qlen + 2 ||
+      __coroc_dns_read(fd, hdr, 2, deadline) < 0) {
+    coroc_net_close(fd);
+    return ETIMEDOUT;
+  }
+
+  len = (hdr[0] << 8) | hdr[1];
+  msg = TSC_ALLOC(len);
+  if (__coroc_dns_read(fd, msg, len, deadline) < 0)
+    err = ETIMEDOUT;
+  else
+    err = __coroc_dns_parse(msg, len, q, qlen, ip, ttl);
+
+  TSC_DEALLOC(msg);
+  coroc_net_close(fd);
+  return err;
+}
+
+// a random query ID, so the answers are hard to be forged,
+// the counter is only used if there is no random source ..
+static uint16_t __coroc_dns_id(void) {
+  uint16_t id;
+
+  if (__coroc_dns.random >= 0 &&
+      read(__coroc_dns.random, &id, sizeof(id)) == sizeof(id))
+    return id;
+
+  return TSC_ATOMIC_INC(__coroc_dns.id) * 2654435761u >> 16;
+}
+
+// ask the servers in turn, return 0 or the errno ..
+static int __coroc_dns_resolve(const char *name, uint32_t *ip,
+                               uint32_t *ttl) {
+  struct sockaddr_in servers[TSC_DNS_MAX_SERVERS];
+  uint8_t q[TSC_DNS_UDP_SIZE];
+  int qlen, num, i, t, err = ETIMEDOUT;
+
+  if (__coroc_dns_hosts(name, ip)) {
+    *ttl = TSC_DNS_HOSTS_TTL;
+    return 0;
+  }
+
+  if ((qlen = __coroc_dns_query(q, name, __coroc_dns_id())) < 0)
+    return EINVAL;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&__coroc_dns.lock);
+  num = __coroc_dns.num;
+  memcpy(servers, __coroc_dns.servers, num * sizeof(servers[0]));
+  lock_release(&__coroc_dns.lock);
+  TSC_SIGNAL_UNMASK();
+
+  for (t = 0; t < TSC_DNS_TRIES; t++) {
+    for (i = 0; i < num; i++) {
+      err = __coroc_dns_udp(&servers[i], q, qlen, ip, ttl);
+      if (err == EMSGSIZE)
+        err = __coroc_dns_tcp(&servers[i], q, qlen, ip, ttl);
+      if (err == 0 || err == ENOENT) return err;
+    }
+  }
+
+  return err;
+}
+
+// FNV-1a of the lower-cased name ..
+static uint64_t __coroc_dns_hash(const char *name) {
+  uint64_t h = 14695981039346656037ull;
+
+  for (; *name != '\0'; name++) {
+    h ^= (uint8_t)((*name >= 'A' && *name <= 'Z') ? *name + 32 : *name);
+    h *= 1099511628211ull;
+  }
+
+  return h;
+}
+
+// make room for a new entry with the lock held, the expired entries
+// go first, then the least recently used ones, but never the pending
+// ones since their queriers still refer to them ..
+static void __coroc_dns_evict(void) {
+  int64_t now = coroc_getmicrotime();
+  queue_item_t *item, *next;
+  int pass;
+
+  for (pass = 0; pass < 2; pass++) {
+    for (item = __coroc_dns.lru.head; item != NULL; item = next) {
+      coroc_dns_entry_t *e = item->owner;
+
+      next = item->next;
+      if (__coroc_dns.lru.status < TSC_DNS_CACHE_MAX && pass > 0) return;
+      if (e->state == TSC_DNS_PENDING || (pass == 0 && e->expire > now))
+        continue;
+
+      queue_extract(&__coroc_dns.lru, item);
+      hash_get(&__coroc_dns.cache, __coroc_dns_hash(e->name), true);
+      free(e->name);
+      TSC_DEALLOC(e);
+    }
+  }
+}
+
+// outside of the coroutines, just call the libc ..
+static int __coroc_dns_blocking(const char *name, uint32_t *ip) {
+  struct addrinfo hints, *res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(name, NULL, &hints, &res) != 0) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  memcpy(ip, &((struct sockaddr_in *)res->ai_addr)->sin_addr, 4);
+  freeaddrinfo(res);
+  return 0;
+}
+
+int coroc_dns_lookup(const char *name, uint32_t *ip) {
+  coroc_dns_entry_t *e;
+  coroc_dns_wait_t wait, *w;
+  uint64_t key = __coroc_dns_hash(name);
+  uint32_t addr = 0, ttl = 0;
+  int err;
+
+  if (strlen(name) > TSC_DNS_NAME_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (TSC_TLS_GET() == NULL) return __coroc_dns_blocking(name, ip);
+
+  pthread_once(&__coroc_dns_once, __coroc_dns_init);
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&__coroc_dns.lock);
+
+  e = hash_get(&__coroc_dns.cache, key, false);
+  if (e != NULL && strcasecmp(e->name, name) != 0) {
+    // another name of the same key, query it without the cache ..
+    lock_release(&__coroc_dns.lock);
+    TSC_SIGNAL_UNMASK();
+
+    if ((err = __coroc_dns_resolve(name, ip, &ttl)) != 0) {
+      errno = err;
+      return -1;
+    }
+    return 0;
+  }
+
+  if (e == NULL) {
+    if (__coroc_dns.lru.status >= TSC_DNS_CACHE_MAX) __coroc_dns_evict();
+
+    e = TSC_ALLOC(sizeof(*e));
+    e->name = strdup(name);
+    e->state = TSC_DNS_DONE;
+    e->error = 0;
+    e->expire = 0;
+    queue_init(&e->waiters);
+    queue_item_init(&e->link, e);
+    hash_insert(&__coroc_dns.cache, key, e);
+  } else {
+    queue_extract(&__coroc_dns.lru, &e->link);
+  }
+  queue_add(&__coroc_dns.lru, &e->link);
+
+  if (e->state == TSC_DNS_PENDING) {
+    // someone is querying it, so wait for the answer ..
+    wait.wait = coroc_coroutine_self();
+    queue_item_init(&wait.link, &wait);
+    queue_add(&e->waiters, &wait.link);
+    vpu_suspend(&__coroc_dns.lock, (unlock_handler_t)lock_release);
+    TSC_SIGNAL_UNMASK();
+
+    if (wait.error != 0) {
+      errno = wait.error;
+      return -1;
+    }
+    *ip = wait.ip;
+    return 0;
+  }
+
+  if (e->expire > coroc_getmicrotime()) {
+    err = e->error;
+    addr = e->ip;
+    lock_release(&__coroc_dns.lock);
+    TSC_SIGNAL_UNMASK();
+
+    if (err != 0) {
+      errno = err;
+      return -1;
+    }
+    *ip = addr;
+    return 0;
+  }
+
+  // the first one after it expires queries it ..
+  e->state = TSC_DNS_PENDING;
+  lock_release(&__coroc_dns.lock);
+  TSC_SIGNAL_UNMASK();
+
+  err = __coroc_dns_resolve(name, &addr, &ttl);
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&__coroc_dns.lock);
+  e->state = TSC_DNS_DONE;
+  e->error = err;
+  e->ip = addr;
+  // only the missing names are cached on errors, the others
+  // (time out, etc.) are queried again by the next lookup ..
+  if (err == 0) {
+    if (ttl < TSC_DNS_MIN_TTL) ttl = TSC_DNS_MIN_TTL;
+    e->expire = coroc_getmicrotime() + ttl * 1000000LL;
+  } else {
+    e->expire = (err == ENOENT)
+                    ? coroc_getmicrotime() + TSC_DNS_NEG_TTL * 1000000LL
+                    : 0;
+  }
+
+  // pass the answer to the waiters, they are readied after unlocking ..
+  for (w = NULL; e->waiters.status > 0;) {
+    coroc_dns_wait_t *next = queue_rem(&e->waiters);
+    next->error = err;
+    next->ip = addr;
+    next->link.next = (queue_item_t *)w;
+    w = next;
+  }
+  lock_release(&__coroc_dns.lock);
+
+  while (w != NULL) {
+    coroc_coroutine_t coroutine = w->wait;
+    // the waiter may be gone once readied ..
+    w = (coroc_dns_wait_t *)w->link.next;
+    vpu_ready(coroutine, false);
+  }
+  TSC_SIGNAL_UNMASK();
+
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  *ip = addr;
+  return 0;
+}
@@ -8,27 +8,32 @@ static inline uint64_t __hash_fun0(uint64_t code) { return (A * code + B) % M; }
 
 static inline uint64_t __hash_fun1(uint64_t code) { return (C * code + D) % N; }
 
+static int __add(hash_t *ht, hash_entry_t *e);
+
 static void __resize(hash_t *ht) {
-  hash_entry_t **tmp, *e;
-  int i, j, newpos;
-  int capacity = 2 * (ht->capacity);
+  hash_entry_t **old[2] = {ht->table[0], ht->table[1]};
+  hash_entry_t *chain = ht->chain, *next;
+  int i, j, capacity = ht->capacity;
 
+  ht->capacity = 2 * capacity;
   for (i = 0; i < 2; i++) {
-    tmp = malloc(capacity * sizeof(hash_entry_t *));
-    memset(tmp, 0, capacity * sizeof(hash_entry_t *));
-
-    for (j = 0; j < ht->capacity; j++) {
-      e = ht->table[i][j];
-      newpos =
-          i ? __hash_fun1(e->key) % capacity : __hash_fun0(e->key) % capacity;
+    ht->table[i] = malloc(ht->capacity * sizeof(hash_entry_t *));
+    memset(ht->table[i], 0, ht->capacity * sizeof(hash_entry_t *));
+  }
 
-      tmp[newpos] = ht->table[i][j];
-    }
+  // the positions are changed, so re-insert all the entries,
+  // the chained ones may fit now ..
+  ht->chain = NULL;
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < capacity; j++)
+      if (old[i][j]) __add(ht, old[i][j]);
+    free(old[i]);
+  }
 
-    free(ht->table[i]);
-    ht->table[i] = tmp;
+  for (; chain != NULL; chain = next) {
+    next = chain->next;
+    __add(ht, chain);
   }
-  ht->capacity = capacity;
 
   return;
 }
@@ -57,6 +62,14 @@ static int __add(hash_t *ht, hash_entry_t *e) {
     i = (i + 1) % 2;
   }
 
+  // the tables are not full, so the keys are colliding on both of
+  // their positions, which no resizing helps, chain the homeless one ..
+  if (ht->size < ht->capacity) {
+    e->next = ht->chain;
+    ht->chain = e;
+    return 0;
+  }
+
   __resize(ht);
   return __add(ht, e);
 }
@@ -64,6 +77,8 @@ static int __add(hash_t *ht, hash_entry_t *e) {
 void hash_init(hash_t *hash) {
   int i;
   hash->capacity = CAPACITY;
+  hash->size = 0;
+  hash->chain = NULL;
   for (i = 0; i < 2; i++) {
     hash->table[i] = malloc(CAPACITY * sizeof(hash_entry_t *));
     memset(hash->table[i], 0, sizeof(hash_entry_t *) * CAPACITY);
@@ -71,6 +86,7 @@ void hash_init(hash_t *hash) {
 }
 
 void hash_fini(hash_t *hash) {
+  hash_entry_t *e, *next;
   int i, j;
   for (i = 0; i < 2; i++)
     if (hash->table[i]) {
@@ -78,23 +94,54 @@ void hash_fini(hash_t *hash) {
         if (hash->table[i][j]) free(hash->table[i][j]);
       free(hash->table[i]);
     }
+
+  for (e = hash->chain; e != NULL; e = next) {
+    next = e->next;
+    free(e);
+  }
+  hash->chain = NULL;
+  hash->size = 0;
+}
+
+// find the entry of the key in the tables or the chain ..
+static hash_entry_t *__find(hash_t *ht, uint64_t key) {
+  hash_entry_t *e;
+  int i, pos;
+
+  for (i = 0; i < 2; i++) {
+    pos = i ? __hash_fun1(key) % ht->capacity
+            : __hash_fun0(key) % ht->capacity;
+    e = ht->table[i][pos];
+    if (e && (e->key == key)) return e;
+  }
+
+  for (e = ht->chain; e != NULL; e = e->next)
+    if (e->key == key) break;
+  return e;
 }
 
 int hash_insert(hash_t *hash, uint64_t key, void *value) {
   hash_entry_t *e = NULL;
 
+  // reject the duplicated key before adding, the `__add' may move
+  // the other entries before it meets the duplicated one ..
+  if (__find(hash, key) != NULL) return -1;
+
   // Init the new element.
   e = malloc(sizeof(hash_entry_t));
   e->key = key;
   e->value = value;
+  e->next = NULL;
 
-  return __add(hash, e);
+  __add(hash, e);
+  hash->size++;
+  return 0;
 }
 
 void *hash_get(hash_t *hash, uint64_t key, bool remove) {
   int i, pos;
   void *value = NULL;
-  hash_entry_t *e;
+  hash_entry_t *e, **pe;
 
   for (i = 0; i < 2; i++) {
     pos = i ? __hash_fun1(key) % hash->capacity
@@ -105,6 +152,20 @@ void *hash_get(hash_t *hash, uint64_t key, bool remove) {
       value = e->value;
       if (remove) {
         hash->table[i][pos] = NULL;
+        hash->size--;
+        free(e);
+      }
+      return value;
+    }
+  }
+
+  // not found in the tables, try the chain ..
+  for (pe = &hash->chain; (e = *pe) != NULL; pe = &e->next) {
+    if (e->key == key) {
+      value = e->value;
+      if (remove) {
+        *pe = e->next;
+        hash->size--;
         free(e);
       }
       break;
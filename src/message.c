@@ -7,12 +7,117 @@
 
 #include "coroutine.h"
 #include "message.h"
+#include "coroc_slab.h"
+#include "coroc_hash.h"
+
+TSC_SIGNAL_MASK_DECLARE
+
+// deliver the payload to the receiver's message,
+// `owned' means the payload is a heap buffer which can be given away ..
+static void __coroc_msg_deliver(coroc_msg_t *dst, void *payload, int32_t size,
+                                bool owned) {
+  if (dst == NULL) {
+    // nobody cares about this message ..
+    if (owned) TSC_DEALLOC(payload);
+    return;
+  }
+
+  if (dst->mode == TSC_MSG_COPY) {
+    __chan_memcpy(dst->msg, payload, (size < dst->size) ? size : dst->size);
+    if (owned) TSC_DEALLOC(payload);
+    return;
+  }
+
+  // the receiver wants a pointer it can free later ..
+  if (!owned) {
+    void *tmp = TSC_ALLOC(size);
+    __chan_memcpy(tmp, payload, size);
+    payload = tmp;
+  }
+
+  dst->size = size;
+  dst->msg = payload;
+}
+
+// keep the message skipped by a tagged receive ..
+static void __coroc_stash_msg(coroc_async_chan_t achan, coroc_msg_item_t item) {
+  queue_t *q;
+
+  if (achan->tags == NULL) {
+    achan->tags = TSC_ALLOC(sizeof(hash_t));
+    hash_init(achan->tags);
+  }
+
+  if ((q = hash_get(achan->tags, item->_msg.tag, false)) == NULL) {
+    q = TSC_ALLOC(sizeof(queue_t));
+    queue_init(q);
+    hash_insert(achan->tags, item->_msg.tag, q);
+  }
+
+  queue_add(&achan->stash, &item->link);
+  queue_add(q, &item->tag_link);
+}
+
+static void __coroc_unstash_msg(coroc_async_chan_t achan,
+                                coroc_msg_item_t item) {
+  queue_t *q = hash_get(achan->tags, item->_msg.tag, false);
+
+  queue_extract(&achan->stash, &item->link);
+  queue_extract(q, &item->tag_link);
+
+  // the tags are often used once, e.g. the RPC replies ..
+  if (q->status == 0) {
+    hash_get(achan->tags, item->_msg.tag, true);
+    TSC_DEALLOC(q);
+  }
+}
+
+// pop the next message, the stashed ones come first,
+// only the owner or the one holding the lock when the owner is blocked
+// can call this, since the `mque' has only one consumer ..
+static coroc_msg_item_t __coroc_mque_rem(coroc_async_chan_t achan,
+                                         bool stashed) {
+  if (stashed && achan->stash.status > 0) {
+    coroc_msg_item_t item = achan->stash.head->owner;
+    __coroc_unstash_msg(achan, item);
+    return item;
+  }
+
+  return mpsc_queue_rem(&achan->mque);
+}
+
+static inline bool __coroc_msg_inline(coroc_msg_item_t item) {
+  return item->_msg.msg == (void *)(item->data);
+}
+
+static void __coroc_free_msg_item(coroc_msg_item_t item) {
+  if (!__coroc_msg_inline(item)) TSC_DEALLOC(item->_msg.msg);
+  coroc_slab_free(item);
+}
 
 static coroc_msg_item_t __coroc_alloc_msg_item(coroc_msg_t *m) {
-  coroc_msg_item_t item = TSC_ALLOC(sizeof(*item));
-  memcpy(item, m, sizeof(*m));
+  coroc_msg_item_t item;
+
+  if (m->mode == TSC_MSG_COPY && m->size <= TSC_MSG_INLINE_MAX) {
+    // copy the small payload into the item ..
+    item = coroc_slab_alloc(sizeof(*item) + m->size);
+    __chan_memcpy(item->data, m->msg, m->size);
+    item->_msg.msg = item->data;
+  } else {
+    item = coroc_slab_alloc(sizeof(*item));
+    item->_msg.msg = m->msg;
+    if (m->mode == TSC_MSG_COPY) {
+      item->_msg.msg = TSC_ALLOC(m->size);
+      __chan_memcpy(item->_msg.msg, m->msg, m->size);
+    }
+  }
+
+  item->_msg.size = m->size;
+  item->_msg.mode = TSC_MSG_OWNED;
+  item->_msg.tag = m->tag;
 
   queue_item_init(&item->link, item);
+  queue_item_init(&item->tag_link, item);
   return item;
 }
 
@@ -20,81 +125,210 @@ static bool __coroc_copy_to_mque(coroc_chan_t chan, void *buf) {
   coroc_async_chan_t achan = (coroc_async_chan_t)chan;
   coroc_msg_item_t msg = __coroc_alloc_msg_item((coroc_msg_t *)buf);
 
-  queue_add(&achan->mque, &msg->link);
+  mpsc_queue_push(&achan->mque, &msg->link);
   return true;
 }
 
 static bool __coroc_copy_from_mque(coroc_chan_t chan, void *buf) {
   coroc_async_chan_t achan = (coroc_async_chan_t)chan;
-  coroc_msg_item_t msg = queue_rem(&achan->mque);
+  int32_t mode = buf ? ((coroc_msg_t *)buf)->mode : TSC_MSG_OWNED;
+  coroc_msg_item_t msg = __coroc_mque_rem(achan, mode != TSC_MSG_NEW);
+
+  if (msg != NULL && (mode == TSC_MSG_ITEM || mode == TSC_MSG_NEW)) {
+    ((coroc_msg_t *)buf)->msg = msg;
+    return true;
+  }
 
   if (msg != NULL) {
-    __chan_memcpy(buf, msg, sizeof(struct coroc_msg));
-    // TODO : add a free msg_item list ..
-    free(msg);
+    bool owned = !__coroc_msg_inline(msg);
+    __coroc_msg_deliver(buf, msg->_msg.msg, msg->_msg.size, owned);
+    if (buf != NULL) ((coroc_msg_t *)buf)->tag = msg->_msg.tag;
+    coroc_slab_free(msg);
     return true;
   }
 
   return false;
 }
 
+// the receiver is blocked already, pass the payload to it directly,
+// so no mailbox item is allocated and the payload is copied only once.
+static void __coroc_copy_msg(coroc_chan_t chan, void *dst, void *src) {
+  coroc_msg_t *m = (coroc_msg_t *)src;
+
+  coroc_msg_t *d = (coroc_msg_t *)dst;
+
+  if (d != NULL && (d->mode == TSC_MSG_ITEM || d->mode == TSC_MSG_NEW)) {
+    d->msg = __coroc_alloc_msg_item(m);
+    return;
+  }
+
+  __coroc_msg_deliver(d, m->msg, m->size, m->mode != TSC_MSG_COPY);
+  if (d != NULL) d->tag = m->tag;
+}
+
 void coroc_async_chan_init(coroc_async_chan_t achan) {
   coroc_chan_init((coroc_chan_t)achan, sizeof(struct coroc_msg), false, __coroc_copy_to_mque,
                 __coroc_copy_from_mque);
   coroc_refcnt_init((coroc_refcnt_t)achan, TSC_DEALLOC);
-  atomic_queue_init(&achan->mque);
+  achan->_chan.copy = __coroc_copy_msg;
+  achan->_chan.isasync = 1;
+  mpsc_queue_init(&achan->mque);
+  queue_init(&achan->stash);
+  achan->tags = NULL;
 }
 
 void coroc_async_chan_fini(coroc_async_chan_t achan) {
   lock_acquire(&achan->_chan.lock);
   coroc_msg_item_t msg = 0;
-  while ((msg = queue_rem(&achan->mque)) != NULL) {
-    // FIXME : memory leak may happen here !!
-    free(msg);
-  }
   achan->_chan.close = true;  // !!
+  // the senders check the `close' after pushing ..
+  TSC_SYNC_ALL();
+  while ((msg = __coroc_mque_rem(achan, true)) != NULL) {
+    __coroc_free_msg_item(msg);
+  }
+  if (achan->tags != NULL) {
+    hash_fini(achan->tags);
+    TSC_DEALLOC(achan->tags);
+    achan->tags = NULL;
+  }
   lock_release(&achan->_chan.lock);
 }
 
-int coroc_send(coroc_coroutine_t target, void *buf, int32_t size) {
-  assert(target != NULL);
+static int __coroc_async_chan_send(coroc_async_chan_t achan, coroc_msg_t *m) {
+  coroc_chan_t chan = (coroc_chan_t)achan;
 
-  struct coroc_msg _msg;
-  char *tmp = TSC_ALLOC(size);
-  __chan_memcpy(tmp, buf, size);
+  // the owner is waiting, pass the payload to it directly ..
+  if (TSC_ATOMIC_READ(chan->recv_que.status) > 0)
+    return _coroc_chan_send(chan, m, true);
 
-  _msg.size = size;
-  _msg.msg = tmp;
+  if (chan->close) return CHAN_CLOSED;
 
-  _coroc_chan_send((coroc_chan_t)target, &_msg, true);
+  TSC_SIGNAL_MASK();
+  coroc_msg_item_t msg = __coroc_alloc_msg_item(m);
+  mpsc_queue_push(&achan->mque, &msg->link);
+
+  // the owner may block before seeing the new message,
+  // so wake it up here ..
+  TSC_SYNC_ALL();
+  if (TSC_ATOMIC_READ(chan->recv_que.status) > 0 || chan->close) {
+    lock_acquire(&chan->lock);
+    if (chan->close) {
+      // nobody will receive them ..
+      while ((msg = mpsc_queue_rem(&achan->mque)) != NULL)
+        __coroc_free_msg_item(msg);
+    } else if (!mpsc_queue_empty(&achan->mque)) {
+      __coroc_chan_wakeup_recv(chan);
+    }
+    lock_release(&chan->lock);
+  }
+
+  TSC_SIGNAL_UNMASK();
   return CHAN_SUCCESS;
 }
 
-int coroc_recv(void *buf, int32_t size, bool block) {
-  struct coroc_msg _msg;
-  int ret = _coroc_chan_recv(NULL, &_msg, block);
+// the owner pops the messages without the lock ..
+static int __coroc_async_chan_recv(coroc_msg_t *m, bool block) {
+  coroc_chan_t chan = (coroc_chan_t)coroc_coroutine_self();
+  if (__coroc_copy_from_mque(chan, m)) return CHAN_SUCCESS;
+  return _coroc_chan_recv(chan, m, block);
+}
 
-  // TODO : note the memory has been allocated and copied twice,
-  // sometimes we can optimize this by just copying a pointer, maybe ..
-  __chan_memcpy(buf, _msg.msg, (size < _msg.size) ? size : _msg.size);
-  free(_msg.msg);
+int coroc_send(coroc_coroutine_t target, void *buf, int32_t size) {
+  assert(target != NULL);
 
-  return ret;
+  // the payload is copied only once, by the receiver blocked
+  // on the mailbox or into the mailbox item ..
+  struct coroc_msg _msg = {size, TSC_MSG_COPY, buf, 0};
+  return __coroc_async_chan_send((coroc_async_chan_t)target, &_msg);
+}
+
+int coroc_recv(void *buf, int32_t size, bool block) {
+  struct coroc_msg _msg = {size, TSC_MSG_COPY, buf, 0};
+  return __coroc_async_chan_recv(&_msg, block);
 }
 
 int coroc_sendp(coroc_coroutine_t target, void *ptr, int32_t size) {
   assert(target != NULL);
-  struct coroc_msg _msg = {size, ptr};
-
-  _coroc_chan_send((coroc_chan_t)target, &_msg, true);
-  return CHAN_SUCCESS;
+  struct coroc_msg _msg = {size, TSC_MSG_OWNED, ptr, 0};
+  return __coroc_async_chan_send((coroc_async_chan_t)target, &_msg);
 }
 
 int coroc_recvp(void **ptr, int32_t *size, bool block) {
-  struct coroc_msg _msg;
-  int ret = _coroc_chan_recv(NULL, &_msg, block);
+  struct coroc_msg _msg = {0, TSC_MSG_OWNED, NULL, 0};
+  int ret = __coroc_async_chan_recv(&_msg, block);
   *ptr = _msg.msg;
   *size = _msg.size;
 
   return ret;
 }
+
+int coroc_recv_batch(coroc_msg_item_t *msgs, int max, int *n, bool block) {
+  assert(max > 0 && n != NULL);
+
+  coroc_async_chan_t achan = (coroc_async_chan_t)coroc_coroutine_self();
+
+  // take all the pending ones without the lock ..
+  *n = 0;
+  while (*n < max && (msgs[*n] = __coroc_mque_rem(achan, true)) != NULL)
+    (*n)++;
+  if (*n > 0) return CHAN_SUCCESS;
+
+  // nothing pending, wait for the first one like `coroc_recv' ..
+  struct coroc_msg _msg = {0, TSC_MSG_ITEM, NULL, 0};
+  int ret = _coroc_chan_recv((coroc_chan_t)achan, &_msg, block);
+  if (ret != CHAN_SUCCESS && ret != CHAN_AWAKEN) return ret;
+
+  msgs[(*n)++] = _msg.msg;
+  while (*n < max && (msgs[*n] = __coroc_mque_rem(achan, true)) != NULL)
+    (*n)++;
+  return CHAN_SUCCESS;
+}
+
+void coroc_msg_batch_free(coroc_msg_item_t *msgs, int n) {
+  int i;
+  for (i = 0; i < n; i++) __coroc_free_msg_item(msgs[i]);
+}
+
+int coroc_send_tagged(coroc_coroutine_t target, uint64_t tag, void *buf,
+                      int32_t size) {
+  assert(target != NULL);
+  struct coroc_msg _msg = {size, TSC_MSG_COPY, buf, tag};
+  return __coroc_async_chan_send((coroc_async_chan_t)target, &_msg);
+}
+
+int coroc_recv_tagged(uint64_t tag, void *buf, int32_t size, bool block) {
+  coroc_async_chan_t achan = (coroc_async_chan_t)coroc_coroutine_self();
+  coroc_msg_item_t item = NULL;
+  queue_t *q;
+  int ret = CHAN_SUCCESS;
+
+  // the stashed one with the given tag ..
+  if (achan->tags && (q = hash_get(achan->tags, tag, false)) != NULL) {
+    item = q->head->owner;
+    __coroc_unstash_msg(achan, item);
+    goto __deliver;
+  }
+
+  for (;;) {
+    // check the new messages and stash the others ..
+    while ((item = mpsc_queue_rem(&achan->mque)) != NULL) {
+      if (item->_msg.tag == tag) goto __deliver;
+      __coroc_stash_msg(achan, item);
+    }
+
+    struct coroc_msg _msg = {0, TSC_MSG_NEW, NULL, 0};
+    ret = _coroc_chan_recv((coroc_chan_t)achan, &_msg, block);
+    if (ret != CHAN_SUCCESS && ret != CHAN_AWAKEN) return ret;
+
+    item = _msg.msg;
+    if (item->_msg.tag == tag) break;
+    __coroc_stash_msg(achan, item);
+  }
+
+__deliver:
+  __coroc_msg_deliver(&(struct coroc_msg){size, TSC_MSG_COPY, buf, 0},
+                      item->_msg.msg, item->_msg.size,
+                      !__coroc_msg_inline(item));
+  coroc_slab_free(item);
+  return ret;
+}
@@ -2,6 +2,10 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE.txt file.
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // for the accept4 ..
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -12,17 +16,26 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#if defined(__linux__)
+#include <netinet/udp.h>
+#endif
 
 #include "support.h"
 #include "netpoll.h"
 #include "coroutine.h"
+#include "vpu.h"
+#include "coroc_dns.h"
+
+// the listen backlog of the `coroc_net_announce' ..
+#define TSC_NET_BACKLOG SOMAXCONN
 
 // This is the NET API wrapper for libtsc,
 // copy & modify from the LibTask project.
 
 int coroc_net_lookup(const char *name, uint32_t *ip);
 
-int coroc_net_announce(bool istcp, const char *server, int port) {
+static int __coroc_net_listen(bool istcp, const char *server, int port,
+                              int backlog, bool reuseport) {
   int fd, n, proto;
   struct sockaddr_in sa;
   socklen_t sn;
@@ -46,37 +59,120 @@ int coroc_net_announce(bool istcp, const char *server, int port) {
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&n, sizeof(n));
   }
 
+  n = 1;
+  if (reuseport &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *)&n, sizeof(n)) < 0) {
+    close(fd);
+    return -1;
+  }
+
   if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
     close(fd);
     return -1;
   }
 
-  if (proto == SOCK_STREAM) listen(fd, port);
+  if (proto == SOCK_STREAM && listen(fd, backlog) < 0) {
+    close(fd);
+    return -1;
+  }
 
   coroc_net_nonblock(fd);
   return fd;
 }
 
+int coroc_net_announce(bool istcp, const char *server, int port) {
+  return __coroc_net_listen(istcp, server, port, TSC_NET_BACKLOG, false);
+}
+
+int coroc_net_announce_backlog(bool istcp, const char *server, int port,
+                               int backlog) {
+  return __coroc_net_listen(istcp, server, port, backlog, false);
+}
+
+coroc_net_listeners_t coroc_net_announce_listeners(const char *server,
+                                                   int port, int backlog) {
+  int i, fd, num = vpu_manager.xt_index;
+  coroc_net_listeners_t ls;
+  struct sockaddr_in sa;
+  socklen_t len;
+
+  ls = TSC_ALLOC(sizeof(struct coroc_net_listeners) + num * sizeof(int));
+  ls->num = 0;
+
+  for (i = 0; i < num; i++) {
+    if ((fd = __coroc_net_listen(true, server, port, backlog, true)) < 0) {
+      coroc_net_listeners_close(ls);
+      return NULL;
+    }
+    ls->fds[ls->num++] = fd;
+
+    // all the others are bound to the port picked for the first one ..
+    len = sizeof(sa);
+    if (port == 0 && getsockname(fd, (struct sockaddr *)&sa, &len) == 0)
+      port = ntohs(sa.sin_port);
+  }
+
+  return ls;
+}
+
+void coroc_net_listeners_close(coroc_net_listeners_t ls) {
+  int i;
+
+  for (i = 0; i < ls->num; i++) coroc_net_close(ls->fds[i]);
+  TSC_DEALLOC(ls);
+}
+
 int coroc_net_timed_accept(int fd, char *server, int *port, int64_t usec) {
   int cfd, one;
   struct sockaddr_in sa;
   uint8_t *ip;
   socklen_t len;
 
-  if (usec <= 0)
-    coroc_net_wait(fd, TSC_NETPOLL_READ);
-  else if (!coroc_net_timedwait(fd, TSC_NETPOLL_READ, usec))
+  len = sizeof sa;
+
+#if defined(ENABLE_IO_URING)
+  // the multishot accept gives no address, ask for it if needed ..
+  if ((cfd = __coroc_uring_accept(fd, usec)) >= 0) {
+    __coroc_netpoll_reset(cfd);
+    if ((server || port) &&
+        getpeername(cfd, (struct sockaddr *)&sa, &len) < 0)
+      memset(&sa, 0, sizeof sa);
+    goto accepted;
+  }
+
+  if (cfd != -ENOSYS && cfd != -EAGAIN) {
+    errno = -cfd;
     return -1;
+  }
+#endif
 
-  len = sizeof sa;
+  // the readiness is edge-triggered, so wait only after the EAGAIN,
+  // or the connections queued behind this one are never accepted ..
+  for (;;) {
+#if defined(__APPLE__)
+    cfd = accept(fd, (void*)&sa, &len);
+#else
+    cfd = accept4(fd, (void *)&sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#endif
+    if (cfd >= 0 || errno != EAGAIN) break;
+
+    if (usec <= 0)
+      coroc_net_wait(fd, TSC_NETPOLL_READ);
+    else if (!coroc_net_timedwait(fd, TSC_NETPOLL_READ, usec))
+      return -1;
+    len = sizeof sa;
+  }
+
+  if (cfd < 0) return -1;
 #if defined(__APPLE__)
-  if ((cfd = accept(fd, (void*)&sa, &len)) < 0) return -1;
   coroc_net_nonblock(cfd);
 #else
-  if ((cfd = accept4(fd, (void *)&sa, &len, 
-                     SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) return -1;
+  __coroc_netpoll_reset(cfd);
 #endif
 
+#if defined(ENABLE_IO_URING)
+accepted:
+#endif
   if (server) {
     ip = (uint8_t *)&sa.sin_addr;
     snprintf(server, 16, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
@@ -95,6 +191,50 @@ int coroc_net_accept(int fd, char *server, int *port) {
   return coroc_net_timed_accept(fd, server, port, 0);
 }
 
+static inline int __coroc_net_accept4(int fd) {
+  int cfd, one = 1;
+
+#if defined(__APPLE__)
+  if ((cfd = accept(fd, NULL, NULL)) < 0) return cfd;
+  coroc_net_nonblock(cfd);
+#else
+  if ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+    return cfd;
+  __coroc_netpoll_reset(cfd);
+#endif
+
+  setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof one);
+  return cfd;
+}
+
+int coroc_net_accept_many(int fd, int *cfds, int n) {
+  int got = 0;
+
+#if defined(ENABLE_IO_URING)
+  int one = 1;
+
+  // the connections may be queued by the multishot accept ..
+  if ((cfds[0] = __coroc_uring_accept(fd, 0)) >= 0) {
+    __coroc_netpoll_reset(cfds[0]);
+    setsockopt(cfds[0], IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof one);
+    got = 1;
+  } else if (cfds[0] != -ENOSYS && cfds[0] != -EAGAIN) {
+    errno = -cfds[0];
+    return -1;
+  }
+#endif
+
+  // drain the backlog until the EAGAIN, then wait if nothing is got ..
+  for (;;) {
+    while (got < n && (cfds[got] = __coroc_net_accept4(fd)) >= 0) got++;
+
+    if (got > 0) return got;
+    if (errno != EAGAIN) return -1;
+
+    coroc_net_wait(fd, TSC_NETPOLL_READ);
+  }
+}
+
 #define CLASS(p) ((*(unsigned char *)(p)) >> 6)
 static int __coroc_parseip(const char *name, uint32_t *ip) {
   uint8_t addr[4];
@@ -139,16 +279,10 @@ static int __coroc_parseip(const char *name, uint32_t *ip) {
 }
 
 int coroc_net_lookup(const char *name, uint32_t *ip) {
-  struct hostent *he;
-
   if (__coroc_parseip(name, ip) >= 0) return 0;
 
-  if ((he = gethostbyname(name)) != 0) {
-    *ip = *(uint32_t *)he->h_addr;
-    return 0;
-  }
-
-  return -1;
+  // only the calling coroutine waits for the DNS ..
+  return coroc_dns_lookup(name, ip);
 }
 
 int coroc_net_timed_dial(bool istcp, const char *server, int port, int64_t usec) {
@@ -175,6 +309,18 @@ int coroc_net_timed_dial(bool istcp, const char *server, int port, int64_t usec)
   sa.sin_family = AF_INET;
   sa.sin_port = htons(port);
 
+#if defined(ENABLE_IO_URING)
+  if ((n = __coroc_uring_connect(fd, (struct sockaddr *)&sa, sizeof sa,
+                                 usec)) == 0)
+    return fd;
+
+  if (n != -ENOSYS && n != -EAGAIN) {
+    coroc_net_close(fd);
+    errno = -n;
+    return -1;
+  }
+#endif
+
   if (connect(fd, (struct sockaddr *)&sa, sizeof sa) < 0 &&
       errno != EINPROGRESS) {
     close(fd);
@@ -185,7 +331,7 @@ int coroc_net_timed_dial(bool istcp, const char *server, int port, int64_t usec)
   if (usec <= 0) {
     coroc_net_wait(fd, TSC_NETPOLL_WRITE);
   } else if (!coroc_net_timedwait(fd, TSC_NETPOLL_WRITE, usec)) {
-    close(fd);
+    coroc_net_close(fd);
     return -1;
   }
 
@@ -196,7 +342,7 @@ int coroc_net_timed_dial(bool istcp, const char *server, int port, int64_t usec)
   sn = sizeof n;
   getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&n, &sn);
   if (n == 0) n = ECONNREFUSED;
-  close(fd);
+  coroc_net_close(fd);
   errno = n;
 
   return -1;
@@ -205,3 +351,85 @@ int coroc_net_timed_dial(bool istcp, const char *server, int port, int64_t usec)
 int coroc_net_dial(bool istcp, const char *server, int port) {
   return coroc_net_timed_dial(istcp, server, port, 0);
 }
+
+int coroc_net_recvmmsg(int fd, struct mmsghdr *msgs, int n, int flags) {
+#if defined(__linux__)
+  int m;
+
+#if defined(ENABLE_IO_URING)
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+
+  // one message a time from the data queued by the multishot recv ..
+  if (desc != NULL && __coroc_uring_streamed(desc)) {
+    if ((m = coroc_net_recvmsg(fd, &msgs[0].msg_hdr, 0)) < 0) return -1;
+    msgs[0].msg_len = m;
+    return 1;
+  }
+#endif
+
+  // the fd is non-blocking, so it returns with all the queued ones
+  // (at most `n'), and waits only if there is none ..
+  while ((m = recvmmsg(fd, msgs, n, flags, NULL)) < 0 && errno == EAGAIN)
+    coroc_net_wait(fd, TSC_NETPOLL_READ);
+
+  return m;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+int coroc_net_sendmmsg(int fd, struct mmsghdr *msgs, int n, int flags) {
+#if defined(__linux__)
+  int m, done = 0;
+
+  while (done < n) {
+    if ((m = sendmmsg(fd, msgs + done, n - done, flags)) < 0) {
+      if (errno != EAGAIN) return (done > 0) ? done : -1;
+      coroc_net_wait(fd, TSC_NETPOLL_WRITE);
+      continue;
+    }
+    done += m;
+  }
+
+  return done;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+int coroc_net_udp_gro(int fd, bool on) {
+#if defined(UDP_GRO)
+  int n = on ? 1 : 0;
+  return setsockopt(fd, SOL_UDP, UDP_GRO, &n, sizeof n);
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+int coroc_net_udp_gso(int fd, int size) {
+#if defined(UDP_SEGMENT)
+  return setsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof size);
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+int coroc_net_udp_segment(const struct msghdr *msg) {
+#if defined(UDP_GRO)
+  struct cmsghdr *cm;
+  int size;
+
+  for (cm = CMSG_FIRSTHDR(msg); cm != NULL;
+       cm = CMSG_NXTHDR((struct msghdr *)msg, cm)) {
+    if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+      memcpy(&size, CMSG_DATA(cm), sizeof size);
+      return size;
+    }
+  }
+#endif
+  return 0;
+}
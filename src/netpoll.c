@@ -2,26 +2,118 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE.txt file.
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // for the splice ..
+#endif
+
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
 
 #include "vpu.h"
 #include "netpoll.h"
 #include "time.h"
 
+// the fd table has two levels, so it grows without moving the descs,
+// and the descs are never freed ..
+#define TSC_NETPOLL_TABLE_BITS 10
+#define TSC_NETPOLL_TABLE_SIZE (1 << TSC_NETPOLL_TABLE_BITS)
+#define TSC_NETPOLL_TABLE_MASK (TSC_NETPOLL_TABLE_SIZE - 1)
+
+TSC_TLS_DECLARE
 TSC_SIGNAL_MASK_DECLARE
 
+static struct coroc_poll_desc *__coroc_poll_table[TSC_NETPOLL_TABLE_SIZE];
+static int __coroc_num_wait = 0;
+
+coroc_poll_desc_t __coroc_netpoll_desc(int fd) {
+  uint32_t hi = (uint32_t)fd >> TSC_NETPOLL_TABLE_BITS;
+  uint32_t i;
+
+  if (fd < 0 || hi >= TSC_NETPOLL_TABLE_SIZE) return NULL;
+
+  struct coroc_poll_desc *chunk = TSC_ATOMIC_READ(__coroc_poll_table[hi]);
+  if (chunk == NULL) {
+    chunk = TSC_ALLOC(TSC_NETPOLL_TABLE_SIZE * sizeof(struct coroc_poll_desc));
+    for (i = 0; i < TSC_NETPOLL_TABLE_SIZE; i++) {
+      chunk[i].fd = (hi << TSC_NETPOLL_TABLE_BITS) | i;
+      chunk[i].id = -1;
+      chunk[i].shard = 0;
+      chunk[i].registered = false;
+      chunk[i].ready = 0;
+      queue_init(&chunk[i].rw[0]);
+      queue_init(&chunk[i].rw[1]);
+      queue_init(&chunk[i].rw[2]);
+      lock_init(&chunk[i].lock);
+      chunk[i].zerocopy = false;
+      chunk[i].zc_sent = chunk[i].zc_done = 0;
+#if defined(ENABLE_IO_URING)
+      chunk[i].uring = NULL;
+      chunk[i].ops = 0;
+      chunk[i].nouring = false;
+#endif
+    }
+
+    if (!TSC_CAS(&__coroc_poll_table[hi], NULL, chunk)) {
+      TSC_DEALLOC(chunk);
+      chunk = TSC_ATOMIC_READ(__coroc_poll_table[hi]);
+    }
+  }
+
+  return &chunk[fd & TSC_NETPOLL_TABLE_MASK];
+}
+
 int coroc_net_nonblock(int fd) {
+  __coroc_netpoll_reset(fd);
   return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 }
 
+// one read or write, waiting for the fd if it is not ready ..
+static int __coroc_net_rw(int fd, void *buf, int n, int mode, int64_t usec) {
+  int m;
+
+#if defined(ENABLE_IO_URING)
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+
+  if (desc != NULL && !desc->nouring) {
+    if (mode == TSC_NETPOLL_READ)
+      m = __coroc_uring_recv(fd, buf, n, usec);
+    else
+      m = __coroc_uring_send(fd, buf, n, usec);
+
+    if (m >= 0) return m;
+    if (m == -ENOTSOCK) desc->nouring = true;
+    if (m != -ENOSYS && m != -EAGAIN && m != -ENOTSOCK) {
+      errno = -m;
+      return -1;
+    }
+  }
+#endif
+
+  while ((m = (mode == TSC_NETPOLL_READ) ? read(fd, buf, n)
+                                         : write(fd, buf, n)) < 0 &&
+         errno == EAGAIN) {
+    if (usec <= 0)
+      coroc_net_wait(fd, mode);
+    else if (!coroc_net_timedwait(fd, mode, usec))
+      return -1;
+  }
+
+  return m;
+}
+
 int coroc_net_read(int fd, void *buf, int n) {
   int m, total;
   for (total = 0; total < n; total += m) {
-    while ((m = read(fd, (char*)buf + total, n - total)) < 0 &&
-            errno == EAGAIN)
-      coroc_net_wait(fd, TSC_NETPOLL_READ);
+    m = __coroc_net_rw(fd, (char *)buf + total, n - total,
+                       TSC_NETPOLL_READ, 0);
     if (m < 0) return m;
     if (m == 0) break;
   }
@@ -29,20 +121,15 @@ int coroc_net_read(int fd, void *buf, int n) {
 }
 
 int coroc_net_timed_read(int fd, void *buf, int n, int64_t timeout) {
-  int m;
-  while ((m = read(fd, buf, n)) < 0 && errno == EAGAIN)
-    if (!coroc_net_timedwait(fd, TSC_NETPOLL_READ, timeout))
-      return -1;
-  return m;
+  return __coroc_net_rw(fd, buf, n, TSC_NETPOLL_READ, timeout);
 }
 
 int coroc_net_write(int fd, void *buf, int n) {
   int m, total;
 
   for (total = 0; total < n; total += m) {
-    while ((m = write(fd, (char *)buf + total, n - total)) < 0 &&
-           errno == EAGAIN)
-      coroc_net_wait(fd, TSC_NETPOLL_WRITE);
+    m = __coroc_net_rw(fd, (char *)buf + total, n - total,
+                       TSC_NETPOLL_WRITE, 0);
     if (m < 0) return m;
     if (m == 0) break;
   }
@@ -50,120 +137,547 @@ int coroc_net_write(int fd, void *buf, int n) {
   return total;
 }
 
-static void __coroc_poll_desc_init(coroc_poll_desc_t desc, int fd, int mode,
-                                 coroc_inter_timer_t *deadline) {
-  desc->done = false;
-  desc->fd = fd;
-  desc->mode = mode;
-  desc->wait = coroc_coroutine_self();
-  desc->deadline = deadline;
-  lock_init(&desc->lock);
+static inline int __coroc_poll_parked(coroc_poll_desc_t desc) {
+  return (desc->rw[0].status ? TSC_NETPOLL_READ : 0) |
+         (desc->rw[1].status ? TSC_NETPOLL_WRITE : 0) |
+         (desc->rw[2].status ? TSC_NETPOLL_ERROR : 0);
+}
 
-  coroc_refcnt_init(&desc->refcnt, TSC_DEALLOC);
+// unlink the waiter from the desc, with the desc's lock held ..
+static void __coroc_poll_unpark(coroc_poll_desc_t desc,
+                                coroc_poll_wait_t *wait) {
+  queue_extract(&desc->rw[0], &wait->link[0]);
+  queue_extract(&desc->rw[1], &wait->link[1]);
+  queue_extract(&desc->rw[2], &wait->link[2]);
+  wait->parked = false;
+  TSC_ATOMIC_DEC(__coroc_num_wait);
 }
 
-int coroc_net_wait(int fd, int mode) {
-  coroc_poll_desc_t desc = TSC_ALLOC(sizeof(struct coroc_poll_desc));
-  __coroc_poll_desc_init(desc, fd, mode, NULL);
+// wake up all the waiters of the given modes with the desc's lock held,
+// they are linked by the `wake' field to be readied after unlocking.
+// the error wakes up everyone, but the error queue waiters are
+// only woken up by the error ..
+static coroc_poll_wait_t *__coroc_poll_wake(coroc_poll_desc_t desc, int mode,
+                                            coroc_poll_wait_t *list) {
+  int d;
+
+  for (d = 0; d < 3; d++) {
+    if (!(mode & ((1 << d) | TSC_NETPOLL_ERROR))) continue;
+
+    while (desc->rw[d].status > 0) {
+      coroc_poll_wait_t *wait = desc->rw[d].head->owner;
+      __coroc_poll_unpark(desc, wait);
+      wait->mode &= mode;
+      wait->mode |= (mode & TSC_NETPOLL_ERROR);
+      // the readiness is consumed by this waiter, the error too, since
+      // it may be a zerocopy completion and the waiter tries again ..
+      desc->ready &= ~wait->mode;
+      wait->wake = list;
+      list = wait;
+    }
+  }
 
-  TSC_SIGNAL_MASK();
-  // calling the low level Netpoll APIs to add ..
-  lock_acquire(&desc->lock);
-  __coroc_netpoll_add(desc);
-  // then suspend current thread ..
-  vpu_suspend(&desc->lock, (unlock_handler_t)lock_release);
+  return list;
+}
 
-  TSC_SIGNAL_UNMASK();
+static inline void __coroc_poll_ready_list(coroc_poll_wait_t *list) {
+  while (list != NULL) {
+    coroc_coroutine_t coroutine = list->wait;
+    // the waiter may be gone once readied ..
+    list = list->wake;
+    vpu_ready(coroutine, false);
+  }
+}
+
+// called by the backends on the system context ..
+void coroc_netpoll_ready(coroc_poll_desc_t desc, int mode) {
+  coroc_poll_wait_t *list;
+
+  lock_acquire(&desc->lock);
+  // the events of a closed fd may still be pending ..
+  if (!desc->registered) {
+    lock_release(&desc->lock);
+    return;
+  }
 
-  mode = desc->mode;
-  coroc_refcnt_put(desc);
+  desc->ready |= mode;
+  list = __coroc_poll_wake(desc, mode, NULL);
+  if (list != NULL) __coroc_netpoll_arm(desc, __coroc_poll_parked(desc));
+  lock_release(&desc->lock);
 
-  return mode;
+  __coroc_poll_ready_list(list);
 }
 
 static void __coroc_netpoll_timeout(void *arg) {
-  TSC_SIGNAL_MASK();
-
-  bool succ;
   coroc_inter_timer_t *timer = (coroc_inter_timer_t *)arg;
-  coroc_poll_desc_t desc = timer->args;
+  coroc_poll_wait_t *wait = timer->args;
+  coroc_poll_desc_t desc = wait->desc;
 
-  lock_acquire(&desc->lock);
-  // hazard checking ..
-  if (!(succ = TSC_CAS(&desc->done, false, true))) 
-    goto __exit_netpoll_timeout;
-
-  desc->mode = 0;
+  TSC_SIGNAL_MASK();
 
-  __coroc_netpoll_rem(desc);
+  // called with the timer shard's lock held, but the waiter
+  // adds this timer with the desc's lock held, so never wait here ..
+  if (lock_try_acquire(&desc->lock) != 0) {
+    coroc_intertimer_retry(timer);
+    TSC_SIGNAL_UNMASK();
+    return;
+  }
 
-__exit_netpoll_timeout:
-  // NOTE: the lock must be released before calling 
-  // the `vpu_ready()', since the `vpu_ready()' may
-  // cause the current task to be scheduled out to 
-  // run a task with higher priority!!
+  // compete with the poller, the one unparking the waiter wakes it up ..
+  bool succ = wait->parked;
+  if (succ) {
+    __coroc_poll_unpark(desc, wait);
+    __coroc_netpoll_arm(desc, __coroc_poll_parked(desc));
+    wait->mode = 0;
+  }
   lock_release(&desc->lock);
-  if (succ) 
-    vpu_ready(desc->wait, true);
-  coroc_refcnt_put(desc);  // dec the refcnt !!
+
+  if (succ) vpu_ready(wait->wait, false);
 
   TSC_SIGNAL_UNMASK();
 }
 
-int coroc_net_timedwait(int fd, int mode, int64_t usec) {
-  assert (usec > 0);
-
+// wait until the fd is ready for the `mode', the readiness cached
+// since the last wait is consumed without parking or any syscall ..
+static int __coroc_net_wait(int fd, int mode, int64_t usec) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  coroc_poll_wait_t wait;
   coroc_inter_timer_t deadline;
-  struct coroc_poll_desc *desc = TSC_ALLOC(sizeof(struct coroc_poll_desc));
-  __coroc_poll_desc_init(desc, fd, mode, &deadline);
+  vpu_t *vpu = TSC_TLS_GET();
+  int shard = (vpu != NULL) ? vpu->id : 0;
+  int d;
 
-  deadline.when = coroc_getmicrotime() + usec;
-  deadline.period = 0;
-  deadline.func = __coroc_netpoll_timeout;
-  deadline.args = coroc_refcnt_get(desc);  // inc the refcnt!!
-  deadline.owner = NULL;
+  if (desc == NULL) return TSC_NETPOLL_ERROR;
 
   TSC_SIGNAL_MASK();
   lock_acquire(&desc->lock);
-  __coroc_netpoll_add(desc);
-  // add the timer to do timeout check..
-  coroc_add_intertimer(&deadline);
+
+  // the coroutine has been moved to another VPU, so follow it if
+  // nobody else is waiting, the cached readiness is kept ..
+  if (desc->registered && desc->shard != shard &&
+      __coroc_poll_parked(desc) == 0) {
+    __coroc_netpoll_rem(desc);
+    desc->shard = shard;
+    if (__coroc_netpoll_add(desc) < 0) desc->registered = false;
+  }
+
+  if (!desc->registered) {
+    desc->shard = shard;
+    if (__coroc_netpoll_add(desc) < 0) {
+      lock_release(&desc->lock);
+      TSC_SIGNAL_UNMASK();
+      return TSC_NETPOLL_ERROR;
+    }
+    desc->registered = true;
+    desc->ready = 0;
+  }
+
+  if (desc->ready & (mode | TSC_NETPOLL_ERROR)) {
+    mode = desc->ready & (mode | TSC_NETPOLL_ERROR);
+    desc->ready &= ~mode;
+    lock_release(&desc->lock);
+    TSC_SIGNAL_UNMASK();
+    return mode;
+  }
+
+  wait.wait = coroc_coroutine_self();
+  wait.desc = desc;
+  wait.mode = mode;
+  wait.parked = true;
+  for (d = 0; d < 3; d++) {
+    queue_item_init(&wait.link[d], &wait);
+    if (mode & (1 << d)) queue_add(&desc->rw[d], &wait.link[d]);
+  }
+  TSC_ATOMIC_INC(__coroc_num_wait);
+  __coroc_netpoll_arm(desc, __coroc_poll_parked(desc));
+
+  if (usec > 0) {
+    deadline.when = coroc_getcachedtime() + usec;
+    deadline.period = 0;
+    deadline.slack = coroc_timer_slack;
+    deadline.func = __coroc_netpoll_timeout;
+    deadline.args = &wait;
+    deadline.owner = NULL;
+    // add the timer to do timeout check..
+    coroc_add_intertimer(&deadline);
+  }
+
   // then suspend current task ..
   vpu_suspend(&desc->lock, (unlock_handler_t)lock_release);
-  // delete the deadline timer here!!
-  if (coroc_del_intertimer(&deadline) == 0) coroc_refcnt_put(desc);
 
-  // drop the reference ..
-  mode = desc->mode;
-  coroc_refcnt_put(desc);
+  // delete the deadline timer here, it also waits for
+  // the expiry which may still be using the `wait' ..
+  if (usec > 0) coroc_del_intertimer(&deadline);
 
   TSC_SIGNAL_UNMASK();
-  return mode;
+  return wait.mode;
+}
+
+int coroc_net_wait(int fd, int mode) { return __coroc_net_wait(fd, mode, 0); }
+
+int coroc_net_timedwait(int fd, int mode, int64_t usec) {
+  assert (usec > 0);
+  return __coroc_net_wait(fd, mode, usec);
+}
+
+// the vectors are advanced by the partial progress, so they are
+// copied, onto the stack if there are not too many of them ..
+#define TSC_NET_IOV_STACK 16
+
+static void __coroc_net_iov_skip(struct iovec **iov, int *cnt, size_t m) {
+  while (*cnt > 0 && m >= (*iov)->iov_len) {
+    m -= (*iov)->iov_len;
+    (*iov)++;
+    (*cnt)--;
+  }
+  if (*cnt > 0) {
+    (*iov)->iov_base = (char *)(*iov)->iov_base + m;
+    (*iov)->iov_len -= m;
+  }
+}
+
+#if defined(ENABLE_IO_URING)
+// the data may be queued by the multishot recv already,
+// so the fd can't be read by the syscalls ..
+static inline bool __coroc_net_streamed(int fd) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  return desc != NULL && __coroc_uring_streamed(desc);
+}
+
+static ssize_t __coroc_net_streamed_readv(int fd, const struct iovec *iov,
+                                          int cnt) {
+  ssize_t total = 0;
+  int i, m;
+
+  for (i = 0; i < cnt; i++) {
+    if ((m = coroc_net_read(fd, iov[i].iov_base, iov[i].iov_len)) < 0)
+      return m;
+    total += m;
+    if (m < (int)iov[i].iov_len) break;
+  }
+
+  return total;
 }
+#endif
+
+// go on with the vectors of the `msg' until all done, by the readv,
+// writev or sendmsg (if `flags' >= 0), the ancillary data is sent
+// with the first part only ..
+static ssize_t __coroc_net_rwmsg(int fd, const struct msghdr *msg, int flags,
+                                 int mode) {
+  struct iovec stack[TSC_NET_IOV_STACK], *iov = stack;
+  struct msghdr mh = *msg;
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  bool zerocopy = false;
+  ssize_t m, total = 0;
+  int cnt = msg->msg_iovlen;
+
+#if defined(MSG_ZEROCOPY)
+  // the flag is ignored silently if the SO_ZEROCOPY is not set ..
+  zerocopy = flags > 0 && (flags & MSG_ZEROCOPY) && desc != NULL &&
+             desc->zerocopy;
+#endif
+
+  if (cnt > TSC_NET_IOV_STACK) iov = TSC_ALLOC(cnt * sizeof(struct iovec));
+  memcpy(iov, msg->msg_iov, cnt * sizeof(struct iovec));
+  mh.msg_iov = iov;
+
+  do {
+    mh.msg_iovlen = cnt;
+    if (mode == TSC_NETPOLL_READ)
+      m = readv(fd, mh.msg_iov, cnt);
+    else if (flags < 0)
+      m = writev(fd, mh.msg_iov, cnt);
+    else
+      m = sendmsg(fd, &mh, flags);
+
+    if (m < 0) {
+      if (errno != EAGAIN) {
+        total = -1;
+        break;
+      }
+      coroc_net_wait(fd, mode);
+      continue;
+    }
+    if (m == 0) break;
+
+    // each send gets a new number for its completion ..
+    if (zerocopy) TSC_ATOMIC_INC(desc->zc_sent);
+
+    total += m;
+    mh.msg_control = NULL;
+    mh.msg_controllen = 0;
+    __coroc_net_iov_skip(&mh.msg_iov, &cnt, m);
+  } while (cnt > 0);
+
+  if (iov != stack) TSC_DEALLOC(iov);
+  return total;
+}
+
+ssize_t coroc_net_readv(int fd, const struct iovec *iov, int cnt) {
+  struct msghdr msg;
+
+#if defined(ENABLE_IO_URING)
+  if (__coroc_net_streamed(fd))
+    return __coroc_net_streamed_readv(fd, iov, cnt);
+#endif
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = cnt;
+  return __coroc_net_rwmsg(fd, &msg, -1, TSC_NETPOLL_READ);
+}
+
+ssize_t coroc_net_writev(int fd, const struct iovec *iov, int cnt) {
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = cnt;
+  return __coroc_net_rwmsg(fd, &msg, -1, TSC_NETPOLL_WRITE);
+}
+
+ssize_t coroc_net_sendmsg(int fd, const struct msghdr *msg, int flags) {
+  return __coroc_net_rwmsg(fd, msg, flags, TSC_NETPOLL_WRITE);
+}
+
+ssize_t coroc_net_recvmsg(int fd, struct msghdr *msg, int flags) {
+  int mode = TSC_NETPOLL_READ;
+  ssize_t m;
+
+#if defined(MSG_ERRQUEUE)
+  if (flags & MSG_ERRQUEUE) mode = TSC_NETPOLL_ERROR;
+#endif
+
+#if defined(ENABLE_IO_URING)
+  // only the data into the first vector, without any ancillary data ..
+  if (mode == TSC_NETPOLL_READ && __coroc_net_streamed(fd)) {
+    int i;
+    for (i = 0; i < (int)msg->msg_iovlen; i++) {
+      if (msg->msg_iov[i].iov_len == 0) continue;
+      m = __coroc_net_rw(fd, msg->msg_iov[i].iov_base,
+                         msg->msg_iov[i].iov_len, TSC_NETPOLL_READ, 0);
+      msg->msg_namelen = 0;
+      msg->msg_controllen = 0;
+      msg->msg_flags = 0;
+      return m;
+    }
+  }
+#endif
+
+  while ((m = recvmsg(fd, msg, flags)) < 0 && errno == EAGAIN)
+    coroc_net_wait(fd, mode);
+
+  return m;
+}
+
+int coroc_net_zerocopy(int fd) {
+#if defined(SO_ZEROCOPY)
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  int one = 1;
+
+  if (desc == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+  if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+    return -1;
+
+  desc->zerocopy = true;
+  return 0;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+uint32_t coroc_net_zerocopy_sent(int fd) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  return (desc != NULL) ? TSC_ATOMIC_READ(desc->zc_sent) : 0;
+}
+
+int coroc_net_zerocopy_wait(int fd, uint32_t seq, int64_t usec) {
+#if defined(SO_ZEROCOPY)
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cm;
+  int copied = 0;
+
+  if (desc == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  // the completions may come out of order, but each send
+  // is completed once, so just count them ..
+  while ((int32_t)(TSC_ATOMIC_READ(desc->zc_done) - seq) < 0) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+      if (errno != EAGAIN) return -1;
+      if (!__coroc_net_wait(fd, TSC_NETPOLL_ERROR, usec)) {
+        errno = ETIMEDOUT;
+        return -1;
+      }
+      continue;
+    }
+
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      struct sock_extended_err *serr;
+      uint32_t n;
+
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+
+      serr = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+        continue;
+
+      // the range [ee_info, ee_data] of the sends is completed ..
+      n = serr->ee_data - serr->ee_info + 1;
+      TSC_ATOMIC_ADD(desc->zc_done, n);
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) copied += n;
+    }
+  }
+
+  return copied;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+#if defined(__linux__)
+// the bytes moved by one splice at most, the pipe is grown to it ..
+#define TSC_NET_SPLICE_SIZE (256 * 1024)
+#endif
+
+// fill the coroutine's pipe from `fd_in' by one splice, then drain it
+// to `fd_out', so the pipe is always empty between the calls ..
+ssize_t coroc_net_splice(int fd_in, int fd_out, size_t len) {
+#if defined(__linux__)
+  int *p = coroc_coroutine_self()->splice_pipe;
+  ssize_t n, m, left;
+
+#if defined(ENABLE_IO_URING)
+  // copy the data queued by the multishot recv ..
+  if (__coroc_net_streamed(fd_in)) {
+    char buf[4096];
+
+    if (len > sizeof(buf)) len = sizeof(buf);
+    if ((n = __coroc_net_rw(fd_in, buf, len, TSC_NETPOLL_READ, 0)) <= 0)
+      return n;
+    return (coroc_net_write(fd_out, buf, n) == n) ? n : -1;
+  }
+#endif
+
+  if (p[0] < 0) {
+    if (pipe2(p, O_NONBLOCK | O_CLOEXEC) < 0) return -1;
+    fcntl(p[1], F_SETPIPE_SZ, TSC_NET_SPLICE_SIZE);
+  }
+  if (len > TSC_NET_SPLICE_SIZE) len = TSC_NET_SPLICE_SIZE;
+
+  // the pipe is empty, so the EAGAIN is from the `fd_in' ..
+  while ((n = splice(fd_in, NULL, p[1], NULL, len,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 &&
+         errno == EAGAIN)
+    coroc_net_wait(fd_in, TSC_NETPOLL_READ);
+
+  if (n <= 0) return n;
+
+  // and the pipe is not empty now, so it's from the `fd_out' ..
+  for (left = n; left > 0; left -= m) {
+    while ((m = splice(p[0], NULL, fd_out, NULL, left,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 &&
+           errno == EAGAIN)
+      coroc_net_wait(fd_out, TSC_NETPOLL_WRITE);
+
+    if (m <= 0) {
+      // the data left in the pipe can't be dropped, so drop the pipe ..
+      close(p[0]);
+      close(p[1]);
+      p[0] = p[1] = -1;
+      return -1;
+    }
+  }
+
+  return n;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+ssize_t coroc_net_sendfile(int fd_out, int fd_in, off_t *offset,
+                           size_t count) {
+#if defined(__linux__)
+  ssize_t m, total = 0;
+
+  while ((size_t)total < count) {
+    if ((m = sendfile(fd_out, fd_in, offset, count - total)) < 0) {
+      if (errno != EAGAIN) return -1;
+      coroc_net_wait(fd_out, TSC_NETPOLL_WRITE);
+      continue;
+    }
+    if (m == 0) break;
+    total += m;
+  }
+
+  return total;
+#else
+  errno = ENOTSUP;
+  return -1;
+#endif
+}
+
+// forget the fd's registration and cached readiness,
+// the parked waiters are woken up with the error ..
+static void __coroc_netpoll_detach(coroc_poll_desc_t desc) {
+  coroc_poll_wait_t *list;
 
-int coroc_netpoll_wakeup(coroc_poll_desc_t desc) {
   lock_acquire(&desc->lock);
-#if 0
-  // hazard checking, maybe not neccessary..
-  // if (desc->done) goto __exit_netpoll_wakeup;
-  if (!TSC_CAS(&desc->done, false, true)) goto __exit_netpoll_wakeup;
-#endif
-
-  // must remove the desc before wakeup the wait task,
-  // so the netpoll will not return this desc again!!
-  __coroc_netpoll_rem(desc);
-  
-  // since the `desc->wait' will release the desc, 
-  // so we must release the lock before calling vpu_ready
-  // to wakeup `desc->wait' !!
+  list = __coroc_poll_wake(desc, TSC_NETPOLL_ERROR, NULL);
+  if (desc->registered) __coroc_netpoll_rem(desc);
+  desc->registered = false;
+  desc->ready = 0;
+  desc->zerocopy = false;
+  desc->zc_sent = desc->zc_done = 0;
+#if defined(ENABLE_IO_URING)
+  list = __coroc_uring_detach(desc, list);
+  desc->nouring = false;
+#endif
   lock_release(&desc->lock);
 
-  // this function must be called by
-  // system context, so don not need
-  // to mask the signals ..
-  vpu_ready(desc->wait, false);
+  __coroc_poll_ready_list(list);
+}
 
-  return 0;
+// called for the newly created fds, since the fd number may be
+// reused after a plain `close' without the `coroc_net_close' ..
+void __coroc_netpoll_reset(int fd) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  if (desc == NULL) return;
+
+  TSC_SIGNAL_MASK();
+  __coroc_netpoll_detach(desc);
+  TSC_SIGNAL_UNMASK();
+}
+
+// the fds waited by the netpoll must be closed by this ..
+int coroc_net_close(int fd) {
+  __coroc_netpoll_reset(fd);
+  return close(fd);
+}
+
+int __coroc_netpoll_size(void) {
+#if defined(ENABLE_IO_URING)
+  return TSC_ATOMIC_READ(__coroc_num_wait) + __coroc_uring_size();
+#else
+  return TSC_ATOMIC_READ(__coroc_num_wait);
+#endif
 }
 
-void coroc_netpoll_initialize(void) { __coroc_netpoll_init(128); }
+void coroc_netpoll_initialize(int np) { __coroc_netpoll_init(np, 128); }
@@ -3,85 +3,189 @@
 // license that can be found in the LICENSE.txt file.
 
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
 
 #include "netpoll.h"
-#include "refcnt.h"
 
+// each VPU polls its own epoll instance, so the readiness of an fd
+// wakes up its waiters in the local running queue of the VPU which
+// registered it. the shards and the timerfd are all added to the root
+// instance, it is polled by the last awake VPU to wait for any of them ..
 static int __coroc_epfd = -1;
-static int __coroc_num_op = 0;
+static int __coroc_timerfd = -1;
+static int __coroc_num_shard = 0;
+static int *__coroc_shard_epfd = NULL;
+
+int __coroc_netpoll_init(int nshard, int max) {
+  struct epoll_event ev;
+  int i;
+
+  __coroc_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (__coroc_epfd < 0) return __coroc_epfd;
+
+  __coroc_num_shard = nshard;
+  __coroc_shard_epfd = TSC_ALLOC(nshard * sizeof(int));
+
+  for (i = 0; i < nshard; i++) {
+    __coroc_shard_epfd[i] = epoll_create1(EPOLL_CLOEXEC);
+    if (__coroc_shard_epfd[i] < 0) return -1;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    if (epoll_ctl(__coroc_epfd, EPOLL_CTL_ADD, __coroc_shard_epfd[i], &ev) < 0)
+      return -1;
+  }
+
+#if defined(ENABLE_IO_URING)
+  // the rings share the index with their shards, since a ring's fd
+  // becomes readable once some completions can be reaped ..
+  if (__coroc_uring_init(nshard) == 0) {
+    for (i = 0; i < nshard; i++) {
+      ev.events = EPOLLIN;
+      ev.data.u64 = i;
+      epoll_ctl(__coroc_epfd, EPOLL_CTL_ADD, __coroc_uring_fd(i), &ev);
+    }
+  }
+#endif
+
+  // the timerfd wakes up the polling VPU when the earliest timer expires,
+  // it is tagged with the index after the last shard ..
+  __coroc_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (__coroc_timerfd >= 0) {
+    ev.events = EPOLLIN;
+    ev.data.u64 = nshard;
+    if (epoll_ctl(__coroc_epfd, EPOLL_CTL_ADD, __coroc_timerfd, &ev) < 0) {
+      close(__coroc_timerfd);
+      __coroc_timerfd = -1;
+    }
+  }
 
-int __coroc_netpoll_init(int max) {
-  __coroc_epfd = epoll_create(max);
   return __coroc_epfd;
 }
 
+int __coroc_netpoll_timer(uint64_t when) {
+  struct itimerspec its = {{0, 0}, {0, 0}};
+  int64_t delta = (int64_t)when - coroc_getmicrotime();
+
+  if (__coroc_timerfd < 0) return -1;
+
+  // arm it relatively since the runtime clock may be the TSC,
+  // and a zero value disarms the timerfd ..
+  if (delta <= 0) {
+    its.it_value.tv_nsec = 1;
+  } else {
+    its.it_value.tv_sec = delta / 1000000;
+    its.it_value.tv_nsec = (delta % 1000000) * 1000;
+  }
+
+  return timerfd_settime(__coroc_timerfd, 0, &its, NULL);
+}
+
 int __coroc_netpoll_fini(void) {
   // TODO
   return 0;
 }
 
-static inline int __coroc_netpoll_ctl(coroc_poll_desc_t desc, int op) {
+// every fd is registered once for both directions, edge-triggered,
+// to the shard of the VPU waiting for it, the readiness is cached
+// in its desc until some waiter consumes it ..
+int __coroc_netpoll_add(coroc_poll_desc_t desc) {
   struct epoll_event ev;
-  ev.events = EPOLLET;
-
-  if (desc->mode & TSC_NETPOLL_READ) ev.events |= (EPOLLIN | EPOLLRDHUP);
-  if (desc->mode & TSC_NETPOLL_WRITE) ev.events |= EPOLLOUT;
 
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
   ev.data.ptr = desc;
 
-  return epoll_ctl(__coroc_epfd, op, desc->fd, &ev);
+  return epoll_ctl(__coroc_shard_epfd[desc->shard], EPOLL_CTL_ADD, desc->fd,
+                   &ev);
 }
 
-int __coroc_netpoll_add(coroc_poll_desc_t desc) {
-  coroc_refcnt_get(desc);  // inc the refcnt !!
-  TSC_ATOMIC_INC(__coroc_num_op);
-  return __coroc_netpoll_ctl(desc, EPOLL_CTL_ADD);
+int __coroc_netpoll_rem(coroc_poll_desc_t desc) {
+  struct epoll_event ev;
+  return epoll_ctl(__coroc_shard_epfd[desc->shard], EPOLL_CTL_DEL, desc->fd,
+                   &ev);
 }
 
-int __coroc_netpoll_rem(coroc_poll_desc_t desc) {
-  // dec the refcnt!!
-  // NOTE the `desc' will not be freed here
-  // since the refcnt is at least 1 !!
-  coroc_refcnt_put(desc);
-  TSC_ATOMIC_DEC(__coroc_num_op);
-  return __coroc_netpoll_ctl(desc, EPOLL_CTL_DEL);
+int __coroc_netpoll_arm(coroc_poll_desc_t desc, int mode) { return 0; }
+
+void __coroc_netpoll_flush(int shard) {
+#if defined(ENABLE_IO_URING)
+  __coroc_uring_flush(shard, false);
+#endif
 }
 
-bool __coroc_netpoll_polling(int timeout) {
+static bool __coroc_netpoll_shard(int epfd, int timeout) {
   struct epoll_event events[128];
-  int ready, i, mode = 0;
+  int ready, i;
 
-  ready = epoll_wait(__coroc_epfd, events, 128, timeout);
+  ready = epoll_wait(epfd, events, 128, timeout);
 
   if (ready <= 0) return false;
 
   for (i = 0; i < ready; i++) {
     coroc_poll_desc_t desc = events[i].data.ptr;
+    uint32_t ev = events[i].events;
+    int mode = 0;
 
-    // FIXME: hazard checking here, make sure only one
-    //        thread will wakeup this desc !!
-    if (!TSC_CAS(&desc->done, false, true)) 
-      continue;
-
-    if (events[i].events & EPOLLERR) {
-      mode = TSC_NETPOLL_ERROR;
-    } else {
-      if ((desc->mode & TSC_NETPOLL_READ) &&
-          (events[i].events & (EPOLLIN | EPOLLRDHUP)))
-        mode |= TSC_NETPOLL_READ;
+    // the hang-up wakes up both sides, they will get the EOF or EPIPE ..
+    if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) mode |= TSC_NETPOLL_READ;
+    if (ev & (EPOLLOUT | EPOLLHUP)) mode |= TSC_NETPOLL_WRITE;
+    if (ev & EPOLLERR) mode |= TSC_NETPOLL_ERROR;
 
-      if ((desc->mode & TSC_NETPOLL_WRITE) && (events[i].events & EPOLLOUT))
-        mode |= TSC_NETPOLL_WRITE;
-    }
-    // the mode as the return value ..
-    desc->mode = mode;
-    coroc_netpoll_wakeup(desc);
+    coroc_netpoll_ready(desc, mode);
   }
 
   return true;
 }
 
-int __coroc_netpoll_size(void) { return __coroc_num_op; }
+bool __coroc_netpoll_polling(int shard, int timeout) {
+  struct epoll_event events[128];
+  bool found = false;
+  int ready, i;
+
+#if defined(ENABLE_IO_URING)
+  if (shard >= 0) {
+    found = __coroc_uring_polling(shard);
+    if (found) timeout = 0;
+    return __coroc_netpoll_shard(__coroc_shard_epfd[shard], timeout) || found;
+  }
+
+  // never block with the requests not submitted ..
+  for (i = 0; i < __coroc_num_shard; i++) {
+    __coroc_uring_flush(i, true);
+    if (__coroc_uring_polling(i)) found = true;
+  }
+  if (found) timeout = 0;
+#else
+  if (shard >= 0)
+    return __coroc_netpoll_shard(__coroc_shard_epfd[shard], timeout);
+#endif
+
+  // wait for any shard or the timer, then drain the ready shards ..
+  ready = epoll_wait(__coroc_epfd, events, 128, timeout);
+
+  for (i = 0; i < ready; i++) {
+    int index = (int)events[i].data.u64;
+
+    if (index == __coroc_num_shard) {
+      // the timer expired, the schedulers will trigger it ..
+      // EAGAIN if it has been re-armed since, it is still a wakeup ..
+      uint64_t expirations;
+      ssize_t n = read(__coroc_timerfd, &expirations, sizeof(expirations));
+      assert(n == sizeof(expirations) || (n < 0 && errno == EAGAIN));
+      (void)n;
+      found = true;
+      continue;
+    }
+
+    if (__coroc_netpoll_shard(__coroc_shard_epfd[index], 0)) found = true;
+#if defined(ENABLE_IO_URING)
+    if (__coroc_uring_polling(index)) found = true;
+#endif
+  }
+
+  return found;
+}
@@ -10,13 +10,32 @@
 #include <assert.h>
 
 #include "netpoll.h"
-#include "refcnt.h"
 
+// one kqueue per VPU, all of them are added to the root kqueue
+// which is polled by the last awake VPU, like the epoll backend ..
 static int __coroc_kqueue = -1;
-static int __coroc_num_op = 0;
+static int __coroc_num_shard = 0;
+static int *__coroc_shard_kqueue = NULL;
+
+int __coroc_netpoll_init(int nshard, int max) {
+  struct kevent ev;
+  int i;
+
+  __coroc_kqueue = kqueue();
+  if (__coroc_kqueue < 0) return __coroc_kqueue;
+
+  __coroc_num_shard = nshard;
+  __coroc_shard_kqueue = TSC_ALLOC(nshard * sizeof(int));
+
+  for (i = 0; i < nshard; i++) {
+    __coroc_shard_kqueue[i] = kqueue();
+    if (__coroc_shard_kqueue[i] < 0) return -1;
+
+    EV_SET(&ev, __coroc_shard_kqueue[i], EVFILT_READ, EV_ADD | EV_ENABLE, 0,
+           0, (void *)(intptr_t)i);
+    if (kevent(__coroc_kqueue, &ev, 1, NULL, 0, NULL) < 0) return -1;
+  }
 
-int __coroc_netpoll_init(int max) {
-  __coroc_kqueue = kqueue() ;
   return __coroc_kqueue;
 }
 
@@ -25,76 +44,80 @@ int __coroc_netpoll_fini(void) {
   return 0;
 }
 
+// both filters of the fd are registered once, with the `EV_CLEAR'
+// to be edge-triggered like the epoll backend ..
 static inline int __coroc_netpoll_ctl(coroc_poll_desc_t desc, uint16_t flags) {
-  struct kevent ev;
-
-  ev.ident = desc->fd;
+  struct kevent ev[2];
 
-  if (desc->mode & TSC_NETPOLL_READ) ev.filter |= EVFILT_READ;
-  if (desc->mode & TSC_NETPOLL_WRITE) ev.filter |= EVFILT_WRITE;
-  
-  ev.flags = flags;
-  ev.fflags = 0;
-  ev.data = 0;
-  ev.udata = desc;
+  EV_SET(&ev[0], desc->fd, EVFILT_READ, flags, 0, 0, desc);
+  EV_SET(&ev[1], desc->fd, EVFILT_WRITE, flags, 0, 0, desc);
 
-  return kevent(__coroc_kqueue, &ev, 1, NULL, 0, NULL);
+  return kevent(__coroc_shard_kqueue[desc->shard], ev, 2, NULL, 0, NULL);
 }
 
 int __coroc_netpoll_add(coroc_poll_desc_t desc) {
-  coroc_refcnt_get(desc);  // inc the refcnt !!
-  TSC_ATOMIC_INC(__coroc_num_op);
-  return __coroc_netpoll_ctl(desc, EV_ADD | EV_ENABLE);
+  return __coroc_netpoll_ctl(desc, EV_ADD | EV_ENABLE | EV_CLEAR);
 }
 
 int __coroc_netpoll_rem(coroc_poll_desc_t desc) {
-  // dec the refcnt!!
-  // NOTE the `desc' will not be freed here
-  // since the refcnt is at least 1 !!
-  coroc_refcnt_put(desc);
-  TSC_ATOMIC_DEC(__coroc_num_op);
   return __coroc_netpoll_ctl(desc, EV_DELETE);
 }
 
-bool __coroc_netpoll_polling(int timeout) {
-  struct kevent events[128];
-  struct timespec tmout, *ptmout = NULL;
-  int ready, i, mode = 0;
+int __coroc_netpoll_arm(coroc_poll_desc_t desc, int mode) { return 0; }
 
-  if (timeout >= 0) {
-    tmout.tv_sec = timeout / 1000;
-    tmout.tv_nsec = (timeout % 1000) * 1000000;
-    ptmout = &tmout;
-  }
+int __coroc_netpoll_timer(uint64_t when) { return -1; }
+
+void __coroc_netpoll_flush(int shard) {}
+
+static bool __coroc_netpoll_shard(int kq, const struct timespec *tmout) {
+  struct kevent events[128];
+  int ready, i;
 
-  ready = kevent(__coroc_kqueue, events, 128, NULL, 0, ptmout);
+  ready = kevent(kq, NULL, 0, events, 128, tmout);
 
   if (ready <= 0) return false;
 
   for (i = 0; i < ready; i++) {
     coroc_poll_desc_t desc = (coroc_poll_desc_t)events[i].udata;
-
-    // FIXME: hazard checking here, make sure only one
-    //        thread will wakeup this desc !!
-    if (!TSC_CAS(&desc->done, false, true)) 
-      continue;
+    int mode = 0;
 
     if (events[i].flags & EV_ERROR) {
       mode = TSC_NETPOLL_ERROR;
-    } else {
-      if ((desc->mode & TSC_NETPOLL_READ) &&
-          (events[i].filter & EVFILT_READ))
-        mode |= TSC_NETPOLL_READ;
-
-      if ((desc->mode & TSC_NETPOLL_WRITE) && (events[i].filter & EVFILT_WRITE))
-        mode |= TSC_NETPOLL_WRITE;
+    } else if (events[i].filter == EVFILT_READ) {
+      mode = TSC_NETPOLL_READ;
+    } else if (events[i].filter == EVFILT_WRITE) {
+      mode = TSC_NETPOLL_WRITE;
     }
-    // the mode as the return value ..
-    desc->mode = mode;
-    coroc_netpoll_wakeup(desc);
+
+    coroc_netpoll_ready(desc, mode);
   }
 
   return true;
 }
 
-int __coroc_netpoll_size(void) { return __coroc_num_op; }
+bool __coroc_netpoll_polling(int shard, int timeout) {
+  struct kevent events[128];
+  struct timespec tmout, zero = {0, 0}, *ptmout = NULL;
+  bool found = false;
+  int ready, i;
+
+  if (timeout >= 0) {
+    tmout.tv_sec = timeout / 1000;
+    tmout.tv_nsec = (timeout % 1000) * 1000000;
+    ptmout = &tmout;
+  }
+
+  if (shard >= 0)
+    return __coroc_netpoll_shard(__coroc_shard_kqueue[shard], ptmout);
+
+  // wait for any shard, then drain the ready ones ..
+  ready = kevent(__coroc_kqueue, NULL, 0, events, 128, ptmout);
+
+  for (i = 0; i < ready; i++) {
+    int index = (int)(intptr_t)events[i].udata;
+    if (__coroc_netpoll_shard(__coroc_shard_kqueue[index], &zero))
+      found = true;
+  }
+
+  return found;
+}
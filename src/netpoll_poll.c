@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE.txt file.
 
+#include <stdlib.h>
 #include <string.h>
 #include <poll.h>
 #include <fcntl.h>
@@ -10,6 +11,9 @@
 
 #include "netpoll.h"
 
+// the poll is level-triggered, so only the descs with parked waiters
+// are kept in the array, for the modes they are waiting for. it is
+// not sharded, all the VPUs poll the same array ..
 struct {
   int cap;
   int size;
@@ -18,7 +22,7 @@ struct {
   pthread_mutex_t mutex;
 } coroc_netpoll_manager;
 
-int __coroc_netpoll_init(int max) {
+int __coroc_netpoll_init(int nshard, int max) {
   coroc_netpoll_manager.cap = max;
   coroc_netpoll_manager.size = 0;
   coroc_netpoll_manager.fds = malloc(max * sizeof(struct pollfd));
@@ -35,97 +39,101 @@ int __coroc_netpoll_fini(void) {
   return 0;
 }
 
-int __coroc_netpoll_add(coroc_poll_desc_t desc) {
-  pthread_mutex_lock(&coroc_netpoll_manager.mutex);
-
-  // realloc the buffer if the number of waiting requests
-  // exceed the current capacity ..
-  if (coroc_netpoll_manager.size == coroc_netpoll_manager.cap) {
-    coroc_netpoll_manager.cap *= 2;
-    coroc_netpoll_manager.fds =
-        realloc(coroc_netpoll_manager.fds,
-                coroc_netpoll_manager.cap * sizeof(struct pollfd));
-    coroc_netpoll_manager.table = realloc(
-        coroc_netpoll_manager.table, coroc_netpoll_manager.cap * sizeof(void *));
-  }
+int __coroc_netpoll_add(coroc_poll_desc_t desc) { return 0; }
 
-  int size = coroc_netpoll_manager.size;
-
-  coroc_netpoll_manager.table[size] = desc;
-  desc->id = size;  // !!
+int __coroc_netpoll_rem(coroc_poll_desc_t desc) {
+  return __coroc_netpoll_arm(desc, 0);
+}
 
-  coroc_netpoll_manager.fds[size].fd = desc->fd;
-  coroc_netpoll_manager.fds[size].events = 0;
-  coroc_netpoll_manager.fds[size].revents = 0;
+// called with the desc's lock held ..
+int __coroc_netpoll_arm(coroc_poll_desc_t desc, int mode) {
+  struct pollfd *pfds;
+  int id;
 
-  if (desc->mode & TSC_NETPOLL_READ)
-    coroc_netpoll_manager.fds[size].events |= POLLIN;
-  if (desc->mode & TSC_NETPOLL_WRITE)
-    coroc_netpoll_manager.fds[size].events |= POLLOUT;
+  pthread_mutex_lock(&coroc_netpoll_manager.mutex);
+  pfds = coroc_netpoll_manager.fds;
+
+  if (mode == 0) {
+    // delete current one, and copy the last one
+    // to current's spot..
+    if ((id = desc->id) >= 0) {
+      int last = --coroc_netpoll_manager.size;
+      pfds[id] = pfds[last];
+      coroc_netpoll_manager.table[id] = coroc_netpoll_manager.table[last];
+      coroc_netpoll_manager.table[id]->id = id;
+      desc->id = -1;
+    }
+  } else {
+    if ((id = desc->id) < 0) {
+      // realloc the buffer if the number of waiting requests
+      // exceed the current capacity ..
+      if (coroc_netpoll_manager.size == coroc_netpoll_manager.cap) {
+        coroc_netpoll_manager.cap *= 2;
+        coroc_netpoll_manager.fds =
+            realloc(coroc_netpoll_manager.fds,
+                    coroc_netpoll_manager.cap * sizeof(struct pollfd));
+        coroc_netpoll_manager.table =
+            realloc(coroc_netpoll_manager.table,
+                    coroc_netpoll_manager.cap * sizeof(void *));
+        pfds = coroc_netpoll_manager.fds;
+      }
+
+      id = desc->id = coroc_netpoll_manager.size++;
+      coroc_netpoll_manager.table[id] = desc;
+      pfds[id].fd = desc->fd;
+    }
 
-  coroc_netpoll_manager.size++;
+    pfds[id].events = 0;
+    pfds[id].revents = 0;
+    if (mode & TSC_NETPOLL_READ) pfds[id].events |= POLLIN;
+    if (mode & TSC_NETPOLL_WRITE) pfds[id].events |= POLLOUT;
+  }
 
   pthread_mutex_unlock(&coroc_netpoll_manager.mutex);
   return 0;
 }
 
-int __coroc_netpoll_rem(coroc_poll_desc_t desc) {
-  int id, size;
-  struct pollfd *pfds = &coroc_netpoll_manager.fds[0];
+// not supported, the polling VPU checks the timers periodically ..
+int __coroc_netpoll_timer(uint64_t when) { return -1; }
 
-  // pthread_mutex_lock (& coroc_netpoll_manager . mutex);
+void __coroc_netpoll_flush(int shard) {}
 
-  id = desc->id;
-  size = coroc_netpoll_manager.size;
-  // delete current one, and copy the last one
-  // to current's spot..
-  memcpy(&pfds[id], &pfds[size - 1], sizeof(struct pollfd));
-  coroc_netpoll_manager.table[id] = coroc_netpoll_manager.table[size - 1];
-  coroc_netpoll_manager.table[id]->id = id;
+bool __coroc_netpoll_polling(int shard, int timeout) {
+  int size, i, ready;
+  struct pollfd *pfds;
+  coroc_poll_desc_t *descs;
 
-  coroc_netpoll_manager.size--;
+  // poll a snapshot, since the array may be changed by the waiters,
+  // and the descs are never freed ..
+  pthread_mutex_lock(&coroc_netpoll_manager.mutex);
+  size = coroc_netpoll_manager.size;
+  if (size == 0) {
+    pthread_mutex_unlock(&coroc_netpoll_manager.mutex);
+    return false;
+  }
 
-  // pthread_mutex_unlock (& coroc_netpoll_manager . mutex);
-  return 0;
-}
+  pfds = malloc(size * sizeof(struct pollfd));
+  descs = malloc(size * sizeof(void *));
+  memcpy(pfds, coroc_netpoll_manager.fds, size * sizeof(struct pollfd));
+  memcpy(descs, coroc_netpoll_manager.table, size * sizeof(void *));
+  pthread_mutex_unlock(&coroc_netpoll_manager.mutex);
 
-bool __coroc_netpoll_polling(int timeout) {
-  int size, i, mode = 0;
-  struct pollfd *pfds = coroc_netpoll_manager.fds;
-  
-  size = coroc_netpoll_manager.size;
-  if (size == 0) return false;
+  ready = poll(pfds, size, timeout);
 
-  if (poll(pfds, size, timeout) <= 0) return false;
+  for (i = 0; ready > 0 && i < size; i++) {
+    int mode = 0;
 
-  pthread_mutex_lock(&coroc_netpoll_manager.mutex);
+    if (pfds[i].revents == 0) continue;
 
-  for (i = 0; i < size; i++) {
-    coroc_poll_desc_t desc = coroc_netpoll_manager.table[i];
-
-    // FIXME: hazard checking here, make sure only one
-    //        thread will wakeup this desc !!
-    if (!TSC_CAS(&desc->done, false, true)) 
-      continue;
-
-    if (pfds[i].revents & POLLERR) {
-      mode = TSC_NETPOLL_ERROR;
-    } else {
-        if ((desc->mode & TSC_NETPOLL_READ) &&
-            (pfds[i].revents & (POLLIN | POLLRDHUP)))
-            mode |= TSC_NETPOLL_READ;
-        if ((desc->mode & TSC_NETPOLL_WRITE) &&
-            (pfds[i].revents & POLLOUT))
-            mode |= TSC_NETPOLL_WRITE;
-    }
+    if (pfds[i].revents & (POLLIN | POLLHUP)) mode |= TSC_NETPOLL_READ;
+    if (pfds[i].revents & (POLLOUT | POLLHUP)) mode |= TSC_NETPOLL_WRITE;
+    if (pfds[i].revents & (POLLERR | POLLNVAL)) mode |= TSC_NETPOLL_ERROR;
 
-    desc->mode = mode;
-    coroc_netpoll_wakeup(desc);
+    coroc_netpoll_ready(descs[i], mode);
   }
 
-  pthread_mutex_unlock(&coroc_netpoll_manager.mutex);
+  free(pfds);
+  free(descs);
 
-  return true;
+  return ready > 0;
 }
-
-int __coroc_netpoll_size(void) { return coroc_netpoll_manager.size; }
@@ -0,0 +1,780 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "vpu.h"
+#include "netpoll.h"
+
+// one io_uring per VPU, next to its epoll shard. the socket operations
+// are posted as SQEs and submitted in a batch when the VPU runs out of
+// ready coroutines, the completions are reaped by the netpoll polling ..
+#define TSC_URING_ENTRIES 256
+#define TSC_URING_BUF_NUM 128  // must be a power of 2
+#define TSC_URING_BUF_SIZE 4096
+#define TSC_URING_BACKLOG 64  // the accepted fds queued before the cancel
+#define TSC_URING_SUBMIT_BATCH 32  // submitted at once when so many pending
+
+TSC_TLS_DECLARE
+TSC_SIGNAL_MASK_DECLARE
+
+typedef struct coroc_uring {
+  int fd;
+  // the submission queue, the `pending' SQEs are not submitted yet ..
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags;
+  unsigned sq_entries, pending;
+  struct io_uring_sqe *sqes;
+  coroc_lock sq_lock;
+  // the completion queue, only one thread reaps it at a time ..
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  coroc_lock cq_lock;
+  // the provided buffers of the multishot recv, NULL if not supported ..
+  struct io_uring_buf_ring *br;
+  char *bufs;
+  coroc_lock br_lock;
+} coroc_uring_t;
+
+// the single-shot request of a parked coroutine, on its stack ..
+typedef struct coroc_uring_op {
+  coroc_coroutine_t wait;
+  int res;
+} coroc_uring_op_t;
+
+// the accepted fd, or the received data in a provided buffer ..
+typedef struct coroc_uring_result {
+  int res;
+  int off;
+  uint16_t bid;
+} coroc_uring_result_t;
+
+// the multishot recv or accept of a desc, its completions are queued
+// here until some coroutine consumes them, with the desc's lock held.
+// the user data of its requests is tagged by the lowest bit ..
+typedef struct coroc_uring_stream {
+  coroc_poll_desc_t desc;
+  coroc_uring_t *ring;  // the ring of the multishot request
+  int op;
+  bool armed;    // the multishot request is in flight
+  bool closing;  // detached, freed by the last completion
+  bool nobufs;   // the last request ran out of the provided buffers
+  bool single;   // the multishot request is not supported
+  bool eof;
+  int error;
+  unsigned head, tail, cap;
+  coroc_uring_result_t *fifo;
+  queue_t waiters;
+} coroc_uring_stream_t;
+
+static coroc_uring_t *__coroc_uring = NULL;
+static int __coroc_uring_num = 0;
+static int __coroc_uring_wait = 0;
+
+static inline int __coroc_uring_enter(int fd, unsigned n, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, n, 0, flags, NULL, 0);
+}
+
+// give the buffer back to the kernel, may be called by any thread ..
+static void __coroc_uring_buf_put(coroc_uring_t *ring, uint16_t bid) {
+  struct io_uring_buf *buf;
+  uint16_t tail;
+
+  lock_acquire(&ring->br_lock);
+  tail = ring->br->tail;
+  buf = &ring->br->bufs[tail & (TSC_URING_BUF_NUM - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(ring->bufs + bid * TSC_URING_BUF_SIZE);
+  buf->len = TSC_URING_BUF_SIZE;
+  buf->bid = bid;
+  __atomic_store_n(&ring->br->tail, tail + 1, __ATOMIC_RELEASE);
+  lock_release(&ring->br_lock);
+}
+
+static void __coroc_uring_setup_bufs(coroc_uring_t *ring) {
+  struct io_uring_buf_reg reg;
+  size_t len = TSC_URING_BUF_NUM * sizeof(struct io_uring_buf);
+  int i;
+
+  // the buffer ring must be page aligned ..
+  ring->br = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ring->br == MAP_FAILED) {
+    ring->br = NULL;
+    return;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+  reg.ring_entries = TSC_URING_BUF_NUM;
+  reg.bgid = 0;
+
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0) {
+    munmap(ring->br, len);
+    ring->br = NULL;
+    return;
+  }
+
+  ring->bufs = TSC_ALLOC(TSC_URING_BUF_NUM * TSC_URING_BUF_SIZE);
+  for (i = 0; i < TSC_URING_BUF_NUM; i++) __coroc_uring_buf_put(ring, i);
+}
+
+static int __coroc_uring_setup(coroc_uring_t *ring) {
+  struct io_uring_params p;
+  size_t len, cqlen;
+  char *sq;
+  unsigned i, *array;
+
+  memset(&p, 0, sizeof(p));
+  ring->fd = syscall(__NR_io_uring_setup, TSC_URING_ENTRIES, &p);
+  if (ring->fd < 0) return -1;
+
+  // the old kernels without these are not supported ..
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_NODROP)) {
+    close(ring->fd);
+    return -1;
+  }
+
+  len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (cqlen > len) len = cqlen;
+
+  sq = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    munmap(sq, len);
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+  ring->sq_entries = p.sq_entries;
+  ring->pending = 0;
+
+  // the SQEs are always used in order ..
+  array = (unsigned *)(sq + p.sq_off.array);
+  for (i = 0; i < p.sq_entries; i++) array[i] = i;
+
+  ring->cq_head = (unsigned *)(sq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(sq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(sq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+
+  lock_init(&ring->sq_lock);
+  lock_init(&ring->cq_lock);
+  lock_init(&ring->br_lock);
+
+  __coroc_uring_setup_bufs(ring);
+  return ring->fd;
+}
+
+// set up all the rings, or none of them ..
+int __coroc_uring_init(int nshard) {
+  coroc_uring_t *rings = TSC_ALLOC(nshard * sizeof(coroc_uring_t));
+  int i;
+
+  for (i = 0; i < nshard; i++) {
+    if (__coroc_uring_setup(&rings[i]) < 0) {
+      while (--i >= 0) close(rings[i].fd);
+      TSC_DEALLOC(rings);
+      return -1;
+    }
+  }
+
+  __coroc_uring_num = nshard;
+  __coroc_uring = rings;
+  return 0;
+}
+
+int __coroc_uring_fd(int shard) {
+  return (__coroc_uring != NULL) ? __coroc_uring[shard].fd : -1;
+}
+
+int __coroc_uring_size(void) { return TSC_ATOMIC_READ(__coroc_uring_wait); }
+
+// submit the pending SQEs, with the ring's `sq_lock' held ..
+static void __coroc_uring_submit(coroc_uring_t *ring) {
+  unsigned flags = 0;
+  int ret;
+
+  // the overflowed completions are flushed by the `GETEVENTS' ..
+  if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+    flags |= IORING_ENTER_GETEVENTS;
+
+  if (ring->pending == 0 && flags == 0) return;
+
+  ret = __coroc_uring_enter(ring->fd, ring->pending, flags);
+  if (ret > 0) ring->pending -= ret;
+}
+
+// the SQE at the tail, cleared, it must be already reserved ..
+static inline struct io_uring_sqe *__coroc_uring_next(coroc_uring_t *ring) {
+  struct io_uring_sqe *sqe = &ring->sqes[*ring->sq_tail & *ring->sq_mask];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return sqe;
+}
+
+// get `n' free SQEs in a row, with the ring's `sq_lock' held ..
+static struct io_uring_sqe *__coroc_uring_sqe(coroc_uring_t *ring,
+                                              unsigned n) {
+  unsigned tail = *ring->sq_tail;
+  unsigned head;
+
+  // don't let the busy VPUs batch too many, only the SQEs posted before
+  // are submitted here, their waiters have released the `sq_lock' ..
+  if (ring->pending >= TSC_URING_SUBMIT_BATCH) __coroc_uring_submit(ring);
+
+  head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head + n > ring->sq_entries) {
+    __coroc_uring_submit(ring);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head + n > ring->sq_entries) return NULL;
+  }
+
+  return __coroc_uring_next(ring);
+}
+
+static inline void __coroc_uring_push(coroc_uring_t *ring) {
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+  ring->pending++;
+}
+
+static void __coroc_uring_cancel(coroc_uring_t *ring, int fd, uint64_t data) {
+  struct io_uring_sqe *sqe;
+
+  lock_acquire(&ring->sq_lock);
+  if ((sqe = __coroc_uring_sqe(ring, 1)) != NULL) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    if (fd >= 0)
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    else
+      sqe->addr = data;
+    sqe->user_data = 0;
+    __coroc_uring_push(ring);
+  }
+  __coroc_uring_submit(ring);
+  lock_release(&ring->sq_lock);
+}
+
+static void __coroc_uring_stream_free(coroc_uring_stream_t *s) {
+  // the results never consumed ..
+  for (; s->head != s->tail; s->head++) {
+    int res = s->fifo[s->head & (s->cap - 1)].res;
+    if (s->op == IORING_OP_ACCEPT)
+      close(res);
+    else
+      __coroc_uring_buf_put(s->ring, s->fifo[s->head & (s->cap - 1)].bid);
+  }
+
+  TSC_DEALLOC(s->fifo);
+  TSC_DEALLOC(s);
+}
+
+static void __coroc_uring_stream_push(coroc_uring_stream_t *s, int res,
+                                      uint16_t bid) {
+  unsigned i;
+
+  if (s->tail - s->head == s->cap) {
+    // grow the fifo and unwrap it ..
+    coroc_uring_result_t *fifo =
+        TSC_ALLOC(2 * s->cap * sizeof(coroc_uring_result_t));
+    for (i = 0; i < s->cap; i++)
+      fifo[i] = s->fifo[(s->head + i) & (s->cap - 1)];
+    TSC_DEALLOC(s->fifo);
+    s->fifo = fifo;
+    s->head = 0;
+    s->tail = s->cap;
+    s->cap *= 2;
+  }
+
+  i = s->tail++ & (s->cap - 1);
+  s->fifo[i].res = res;
+  s->fifo[i].off = 0;
+  s->fifo[i].bid = bid;
+}
+
+// called by the reaper with the ring's `cq_lock' held ..
+static void __coroc_uring_stream_complete(coroc_uring_stream_t *s,
+                                          struct io_uring_cqe *cqe) {
+  coroc_poll_desc_t desc = s->desc;
+  coroc_poll_wait_t *list = NULL;
+  bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+  bool hasbuf = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+  uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  int res = cqe->res;
+
+  lock_acquire(&desc->lock);
+  if (!more) s->armed = false;
+
+  if (s->closing) {
+    // drop the late results, the last one frees the stream ..
+    if (s->op == IORING_OP_ACCEPT && res >= 0) close(res);
+    if (hasbuf) __coroc_uring_buf_put(s->ring, bid);
+    lock_release(&desc->lock);
+    if (!more) __coroc_uring_stream_free(s);
+    return;
+  }
+
+  if (s->op == IORING_OP_ACCEPT && res >= 0) {
+    __coroc_uring_stream_push(s, res, 0);
+    // too many connections not accepted, stop and post it again later ..
+    if (more && s->tail - s->head == TSC_URING_BACKLOG)
+      __coroc_uring_cancel(s->ring, -1, (uint64_t)(uintptr_t)s | 1);
+  } else if (s->op == IORING_OP_RECV && res > 0 && hasbuf) {
+    __coroc_uring_stream_push(s, res, bid);
+  } else if (res == 0) {
+    s->eof = true;
+  } else if (res == -ENOBUFS) {
+    s->nobufs = true;
+  } else if (res == -EINVAL) {
+    // the multishot request may be not supported by this kernel,
+    // the single-shot one reports the error if it is a real one ..
+    s->single = true;
+  } else if (res != -ECANCELED) {
+    s->error = -res;
+  }
+
+  while (s->waiters.status > 0) {
+    coroc_poll_wait_t *wait = queue_rem(&s->waiters);
+    wait->parked = false;
+    wait->wake = list;
+    list = wait;
+  }
+  lock_release(&desc->lock);
+
+  while (list != NULL) {
+    coroc_coroutine_t coroutine = list->wait;
+    list = list->wake;
+    vpu_ready(coroutine, false);
+  }
+}
+
+// reap the completions of the given ring, return false if none ..
+static bool __coroc_uring_reap(coroc_uring_t *ring) {
+  unsigned head, tail;
+  bool found = false;
+
+  if (lock_try_acquire(&ring->cq_lock) != 0) return false;
+
+  head = *ring->cq_head;
+  while (head != (tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))) {
+    for (; head != tail; head++) {
+      struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+      __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+      found = true;
+
+      if (cqe.user_data == 0) continue;
+
+      if (cqe.user_data & 1) {
+        __coroc_uring_stream_complete(
+            (coroc_uring_stream_t *)(uintptr_t)(cqe.user_data & ~1ULL), &cqe);
+      } else {
+        coroc_uring_op_t *op = (coroc_uring_op_t *)(uintptr_t)cqe.user_data;
+        op->res = cqe.res;
+        vpu_ready(op->wait, false);
+      }
+    }
+  }
+
+  lock_release(&ring->cq_lock);
+  return found;
+}
+
+// submit the pending SQEs of the shard, the polling VPU
+// waits for all of them so it never skips the submitting ..
+void __coroc_uring_flush(int shard, bool wait) {
+  coroc_uring_t *ring;
+
+  if (__coroc_uring == NULL) return;
+  ring = &__coroc_uring[shard];
+  if (TSC_ATOMIC_READ(ring->pending) == 0) return;
+
+  if (wait)
+    lock_acquire(&ring->sq_lock);
+  else if (lock_try_acquire(&ring->sq_lock) != 0)
+    return;
+
+  __coroc_uring_submit(ring);
+  lock_release(&ring->sq_lock);
+}
+
+bool __coroc_uring_polling(int shard) {
+  if (__coroc_uring == NULL) return false;
+  __coroc_uring_flush(shard, false);
+  return __coroc_uring_reap(&__coroc_uring[shard]);
+}
+
+// post the single-shot request and wait for its completion,
+// linked with a timeout if `usec' > 0 ..
+static int __coroc_uring_do(coroc_poll_desc_t desc,
+                            const struct io_uring_sqe *req, int64_t usec) {
+  vpu_t *vpu = TSC_TLS_GET();
+  coroc_uring_t *ring;
+  coroc_uring_op_t op;
+  struct __kernel_timespec ts;
+  struct io_uring_sqe *sqe;
+
+  if (__coroc_uring == NULL || vpu == NULL) return -ENOSYS;
+  ring = &__coroc_uring[vpu->id];
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&ring->sq_lock);
+
+  if ((sqe = __coroc_uring_sqe(ring, (usec > 0) ? 2 : 1)) == NULL) {
+    lock_release(&ring->sq_lock);
+    TSC_SIGNAL_UNMASK();
+    return -EAGAIN;
+  }
+
+  *sqe = *req;
+  sqe->user_data = (uint64_t)(uintptr_t)&op;
+
+  if (usec > 0) {
+    sqe->flags |= IOSQE_IO_LINK;
+    __coroc_uring_push(ring);
+
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    // reserved above, never submit the linked one alone ..
+    sqe = __coroc_uring_next(ring);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&ts;
+    sqe->len = 1;
+    sqe->user_data = 0;
+  }
+  __coroc_uring_push(ring);
+
+  op.wait = coroc_coroutine_self();
+  op.res = 0;
+  TSC_ATOMIC_INC(desc->ops);
+  TSC_ATOMIC_INC(__coroc_uring_wait);
+
+  // the SQEs are submitted later by the scheduler, and the completion
+  // can't come before the `sq_lock' is released after the suspending ..
+  vpu_suspend(&ring->sq_lock, (unlock_handler_t)lock_release);
+
+  TSC_ATOMIC_DEC(__coroc_uring_wait);
+  TSC_ATOMIC_DEC(desc->ops);
+  TSC_SIGNAL_UNMASK();
+
+  if (usec > 0 && op.res == -ECANCELED) return -ETIMEDOUT;
+  return op.res;
+}
+
+static void __coroc_uring_timeout(void *arg) {
+  coroc_inter_timer_t *timer = (coroc_inter_timer_t *)arg;
+  coroc_poll_wait_t *wait = timer->args;
+  coroc_poll_desc_t desc = wait->desc;
+  coroc_uring_stream_t *s;
+
+  TSC_SIGNAL_MASK();
+
+  // never wait for the desc's lock with the timer shard's lock held ..
+  if (lock_try_acquire(&desc->lock) != 0) {
+    coroc_intertimer_retry(timer);
+    TSC_SIGNAL_UNMASK();
+    return;
+  }
+
+  bool succ = wait->parked;
+  if (succ) {
+    s = desc->uring;
+    queue_extract(&s->waiters, &wait->link[0]);
+    wait->parked = false;
+    wait->mode = 0;
+  }
+  lock_release(&desc->lock);
+
+  if (succ) vpu_ready(wait->wait, false);
+
+  TSC_SIGNAL_UNMASK();
+}
+
+// post the multishot request of the stream, with the desc's lock held ..
+static bool __coroc_uring_arm(coroc_uring_stream_t *s) {
+  coroc_uring_t *ring = s->ring;
+  struct io_uring_sqe *sqe;
+
+  lock_acquire(&ring->sq_lock);
+  if ((sqe = __coroc_uring_sqe(ring, 1)) == NULL) {
+    lock_release(&ring->sq_lock);
+    return false;
+  }
+
+  sqe->opcode = s->op;
+  sqe->fd = s->desc->fd;
+  if (s->op == IORING_OP_ACCEPT) {
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  } else {
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+  }
+  sqe->user_data = (uint64_t)(uintptr_t)s | 1;
+  __coroc_uring_push(ring);
+  lock_release(&ring->sq_lock);
+
+  s->armed = true;
+  s->nobufs = false;
+  return true;
+}
+
+// wait for the next result of the multishot request, the result
+// is consumed by `fn' with the desc's lock held. it returns -EAGAIN
+// if the single-shot request should be used this time ..
+static int __coroc_uring_stream_wait(coroc_poll_desc_t desc, int op,
+                                     int64_t usec,
+                                     int (*fn)(coroc_uring_stream_t *, void *,
+                                               int),
+                                     void *buf, int n) {
+  vpu_t *vpu = TSC_TLS_GET();
+  coroc_uring_stream_t *s;
+  coroc_poll_wait_t wait;
+  coroc_inter_timer_t deadline;
+  bool timed = false;
+  int ret;
+
+  if (__coroc_uring == NULL || vpu == NULL) return -ENOSYS;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&desc->lock);
+
+  if ((s = desc->uring) == NULL) {
+    s = TSC_ALLOC(sizeof(*s));
+    memset(s, 0, sizeof(*s));
+    s->desc = desc;
+    s->ring = &__coroc_uring[vpu->id];
+    s->op = op;
+    s->cap = 8;
+    s->fifo = TSC_ALLOC(s->cap * sizeof(coroc_uring_result_t));
+    queue_init(&s->waiters);
+    desc->uring = s;
+
+    // the datagrams must not be merged, and an empty one is not
+    // the EOF, so they are always received by the single-shot ones ..
+    if (op == IORING_OP_RECV) {
+      int type = SOCK_STREAM;
+      socklen_t len = sizeof(type);
+      getsockopt(desc->fd, SOL_SOCKET, SO_TYPE, &type, &len);
+      if (type != SOCK_STREAM) s->single = true;
+    }
+  }
+
+  for (;;) {
+    if (s->head != s->tail) {
+      ret = fn(s, buf, n);
+      break;
+    }
+    if (s->error != 0 || s->eof) {
+      ret = s->eof ? 0 : -s->error;
+      break;
+    }
+    if (!s->armed &&
+        (s->op != op || s->nobufs || s->single ||
+         (op == IORING_OP_RECV && s->ring->br == NULL) ||
+         !__coroc_uring_arm(s))) {
+      s->nobufs = false;
+      ret = -EAGAIN;
+      break;
+    }
+
+    wait.wait = coroc_coroutine_self();
+    wait.desc = desc;
+    wait.mode = TSC_NETPOLL_READ;
+    wait.parked = true;
+    queue_item_init(&wait.link[0], &wait);
+    queue_add(&s->waiters, &wait.link[0]);
+    TSC_ATOMIC_INC(__coroc_uring_wait);
+
+    if (usec > 0 && !timed) {
+      deadline.when = coroc_getcachedtime() + usec;
+      deadline.period = 0;
+      deadline.slack = coroc_timer_slack;
+      deadline.func = __coroc_uring_timeout;
+      deadline.args = &wait;
+      deadline.owner = NULL;
+      coroc_add_intertimer(&deadline);
+      timed = true;
+    }
+
+    vpu_suspend(&desc->lock, (unlock_handler_t)lock_release);
+    TSC_ATOMIC_DEC(__coroc_uring_wait);
+
+    lock_acquire(&desc->lock);
+    if (wait.mode == TSC_NETPOLL_ERROR) {
+      ret = -EBADF;
+      break;
+    }
+    // the deadline may expire when not parked ..
+    if (wait.mode == 0 ||
+        (timed && TSC_ATOMIC_READ(deadline.shard) == NULL)) {
+      ret = -ETIMEDOUT;
+      break;
+    }
+    // the desc may be detached and attached again ..
+    if ((s = desc->uring) == NULL) {
+      ret = -EBADF;
+      break;
+    }
+  }
+  lock_release(&desc->lock);
+
+  if (timed) coroc_del_intertimer(&deadline);
+  TSC_SIGNAL_UNMASK();
+
+  return ret;
+}
+
+static int __coroc_uring_copy(coroc_uring_stream_t *s, void *buf, int n) {
+  int copied = 0;
+
+  while (copied < n && s->head != s->tail) {
+    coroc_uring_result_t *e = &s->fifo[s->head & (s->cap - 1)];
+    int len = e->res - e->off;
+
+    if (len > n - copied) len = n - copied;
+    memcpy((char *)buf + copied,
+           s->ring->bufs + e->bid * TSC_URING_BUF_SIZE + e->off, len);
+    e->off += len;
+    copied += len;
+
+    if (e->off == e->res) {
+      __coroc_uring_buf_put(s->ring, e->bid);
+      s->head++;
+    }
+  }
+
+  return copied;
+}
+
+static int __coroc_uring_pop(coroc_uring_stream_t *s, void *buf, int n) {
+  return s->fifo[s->head++ & (s->cap - 1)].res;
+}
+
+// true if the data of the fd may be queued by the multishot recv ..
+bool __coroc_uring_streamed(coroc_poll_desc_t desc) {
+  coroc_uring_stream_t *s = TSC_ATOMIC_READ(desc->uring);
+  return s != NULL && !s->single;
+}
+
+int __coroc_uring_recv(int fd, void *buf, int n, int64_t usec) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  struct io_uring_sqe req;
+  int ret;
+
+  if (desc == NULL) return -EBADF;
+
+  // copy from the provided buffers filled by the multishot recv ..
+  ret = __coroc_uring_stream_wait(desc, IORING_OP_RECV, usec,
+                                  __coroc_uring_copy, buf, n);
+  if (ret != -EAGAIN) return ret;
+
+  memset(&req, 0, sizeof(req));
+  req.opcode = IORING_OP_RECV;
+  req.fd = fd;
+  req.addr = (uint64_t)(uintptr_t)buf;
+  req.len = n;
+  return __coroc_uring_do(desc, &req, usec);
+}
+
+int __coroc_uring_send(int fd, const void *buf, int n, int64_t usec) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  struct io_uring_sqe req;
+
+  if (desc == NULL) return -EBADF;
+
+  memset(&req, 0, sizeof(req));
+  req.opcode = IORING_OP_SEND;
+  req.fd = fd;
+  req.addr = (uint64_t)(uintptr_t)buf;
+  req.len = n;
+  return __coroc_uring_do(desc, &req, usec);
+}
+
+int __coroc_uring_accept(int fd, int64_t usec) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  struct io_uring_sqe req;
+  int ret;
+
+  if (desc == NULL) return -EBADF;
+
+  ret = __coroc_uring_stream_wait(desc, IORING_OP_ACCEPT, usec,
+                                  __coroc_uring_pop, NULL, 0);
+  if (ret != -EAGAIN) return ret;
+
+  memset(&req, 0, sizeof(req));
+  req.opcode = IORING_OP_ACCEPT;
+  req.fd = fd;
+  req.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  return __coroc_uring_do(desc, &req, usec);
+}
+
+int __coroc_uring_connect(int fd, const struct sockaddr *sa, socklen_t len,
+                          int64_t usec) {
+  coroc_poll_desc_t desc = __coroc_netpoll_desc(fd);
+  struct io_uring_sqe req;
+
+  if (desc == NULL) return -EBADF;
+
+  memset(&req, 0, sizeof(req));
+  req.opcode = IORING_OP_CONNECT;
+  req.fd = fd;
+  req.addr = (uint64_t)(uintptr_t)sa;
+  req.off = len;
+  return __coroc_uring_do(desc, &req, usec);
+}
+
+// called with the desc's lock held when the fd is closed, the parked
+// waiters are woken up with the error, and the requests are canceled ..
+coroc_poll_wait_t *__coroc_uring_detach(coroc_poll_desc_t desc,
+                                        coroc_poll_wait_t *list) {
+  coroc_uring_stream_t *s = desc->uring;
+  int i;
+
+  if (s != NULL) {
+    while (s->waiters.status > 0) {
+      coroc_poll_wait_t *wait = queue_rem(&s->waiters);
+      wait->parked = false;
+      wait->mode = TSC_NETPOLL_ERROR;
+      wait->wake = list;
+      list = wait;
+    }
+
+    desc->uring = NULL;
+    if (s->armed) {
+      s->closing = true;
+      __coroc_uring_cancel(s->ring, -1, (uint64_t)(uintptr_t)s | 1);
+    } else {
+      __coroc_uring_stream_free(s);
+    }
+  }
+
+  // the single-shot requests may be posted to any ring ..
+  if (TSC_ATOMIC_READ(desc->ops) > 0) {
+    for (i = 0; i < __coroc_uring_num; i++)
+      __coroc_uring_cancel(&__coroc_uring[i], desc->fd, 0);
+  }
+
+  return list;
+}
@@ -0,0 +1,87 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "support.h"
+#include "coroc_slab.h"
+#include "vpu.h"
+
+TSC_TLS_DECLARE
+TSC_SIGNAL_MASK_DECLARE
+
+static inline uint32_t __coroc_slab_class(size_t size) {
+  uint32_t cls = 0;
+  while (cls < TSC_SLAB_CLASS_NUM && TSC_SLAB_CLASS_SIZE(cls) < size) cls++;
+  return cls;
+}
+
+static inline uint32_t __coroc_slab_limit(uint32_t cls) {
+  uint32_t limit = TSC_SLAB_CACHE_BYTES >> (cls + TSC_SLAB_MIN_SHIFT);
+  return limit > TSC_SLAB_CACHE_MIN ? limit : TSC_SLAB_CACHE_MIN;
+}
+
+void coroc_slab_cache_init(coroc_slab_cache_t *caches) {
+  int i;
+  for (i = 0; i < TSC_SLAB_CLASS_NUM; ++i) {
+    caches[i].head = NULL;
+    caches[i].count = 0;
+  }
+}
+
+void *coroc_slab_alloc(size_t size) {
+  size_t total = size + sizeof(coroc_slab_hdr_t);
+  uint32_t cls = __coroc_slab_class(total);
+  coroc_slab_hdr_t *obj = NULL;
+
+  if (cls < TSC_SLAB_CLASS_NUM) {
+    // the current coroutine must not be moved to
+    // another VPU during fetching the object ..
+    TSC_SIGNAL_MASK();
+    vpu_t *vpu = TSC_TLS_GET();
+    if (vpu != NULL) {
+      coroc_slab_cache_t *cache = &vpu->slab[cls];
+      if ((obj = cache->head) != NULL) {
+        cache->head = *(void **)(obj + 1);
+        cache->count--;
+      }
+    }
+    TSC_SIGNAL_UNMASK();
+
+    total = TSC_SLAB_CLASS_SIZE(cls);
+  }
+
+  if (obj == NULL) {
+    obj = TSC_ALLOC(total);
+    assert(obj != NULL);
+    obj->cls = cls;
+  }
+
+  return obj + 1;
+}
+
+void coroc_slab_free(void *ptr) {
+  if (ptr == NULL) return;
+
+  coroc_slab_hdr_t *obj = (coroc_slab_hdr_t *)ptr - 1;
+  uint32_t cls = obj->cls;
+
+  if (cls < TSC_SLAB_CLASS_NUM) {
+    TSC_SIGNAL_MASK();
+    vpu_t *vpu = TSC_TLS_GET();
+    if (vpu != NULL) {
+      coroc_slab_cache_t *cache = &vpu->slab[cls];
+      if (cache->count < __coroc_slab_limit(cls)) {
+        *(void **)ptr = cache->head;
+        cache->head = obj;
+        cache->count++;
+        obj = NULL;
+      }
+    }
+    TSC_SIGNAL_UNMASK();
+  }
+
+  if (obj != NULL) TSC_DEALLOC(obj);
+}
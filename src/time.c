@@ -8,26 +8,87 @@
 #include <assert.h>
 
 #include "coroc_time.h"
-#if defined(ENABLE_NOTIFY)
-#include "notify.h"
+#if defined(ENABLE_TIMER_WHEEL)
+#include "coroc_timer_wheel.h"
+#endif
+#if defined(ENABLE_TSC_CLOCK)
+#include <cpuid.h>
 #endif
 
 #define TSC_DEFAULT_INTERTIMERS_CAP 32
+#define TSC_TSC_CALIBRATE_NANOSEC 10000000  // 10 ms
 
+TSC_TLS_DECLARE
 TSC_SIGNAL_MASK_DECLARE
 
-static void coroc_send_timer(void *arg) {
-  coroc_timer_t timer = ((coroc_inter_timer_t *)arg)->owner;
+uint32_t coroc_timer_slack = 0;
+
+#if defined(ENABLE_TSC_CLOCK)
+coroc_tsc_clock_t coroc_tsc_clock;
+
+static inline int64_t __monotonic_nanotime(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// measure the TSC frequency against the monotonic clock,
+// only if the TSC is invariant, i.e. it ticks in a constant rate
+// and never stops, and it is synced among all the cores ..
+static void __coroc_tsc_calibrate(void) {
+  unsigned eax, ebx, ecx, edx;
+  struct timespec period = {0, TSC_TSC_CALIBRATE_NANOSEC};
+
+  coroc_tsc_clock.mult = 0;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1 << 8)))
+    return;
+
+  int64_t ns0 = __monotonic_nanotime();
+  uint64_t tsc0 = __builtin_ia32_rdtsc();
+  nanosleep(&period, NULL);
+  int64_t ns1 = __monotonic_nanotime();
+  uint64_t tsc1 = __builtin_ia32_rdtsc();
+
+  if (tsc1 <= tsc0 || ns1 <= ns0) return;
+
+  coroc_tsc_clock.tsc = tsc1;
+  coroc_tsc_clock.ns = ns1;
+  coroc_tsc_clock.mult = ((uint64_t)(ns1 - ns0) << 32) / (tsc1 - tsc0);
+}
+#endif
+
+int64_t coroc_getcachedtime(void) {
+  vpu_t *vpu = TSC_TLS_GET();
+
+  if (vpu == NULL) return coroc_getmicrotime();
+  if (vpu->now == 0) vpu->now = coroc_getmicrotime();
+  return vpu->now;
+}
+
+// send the tick of `when' to the timer's channel, with no timer's lock held,
+// and the tick is dropped if the last one is not received yet ..
+static void __coroc_timer_send(coroc_timer_t timer, uint64_t when) {
+  uint32_t missed = 0;
 
   if (timer->timer.args) {
     typedef void (*func_t)(void);
     func_t f = (func_t)(timer->timer.args);
-    f();  // FIXME : calling f() from a new thread !!
+    f();
   }
 
-  coroc_chan_send((coroc_chan_t)timer, &timer->timer.when);
+  // the ticks already passed will be skipped ..
+  uint64_t now = coroc_getcachedtime();
+  if (timer->timer.period > 0 && now > when)
+    missed = (now - when) / timer->timer.period;
+
+  if (coroc_chan_nbsend((coroc_chan_t)timer, &when) != CHAN_SUCCESS) missed++;
+
+  if (missed > 0) TSC_ATOMIC_ADD(timer->missed, missed);
 }
 
+static void coroc_send_timer(void *arg);
+
 static void inline __coroc_timer_init(coroc_timer_t t, uint32_t period,
                                     void (*func)(void)) {
   // init the buffered channel ..
@@ -38,11 +99,17 @@ static void inline __coroc_timer_init(coroc_timer_t t, uint32_t period,
                   (release_handler_t)(coroc_timer_dealloc));
 
   // init the internal timer ..
+  t->missed = 0;
+  t->firing = 0;
+  t->due = 0;
+  t->next = NULL;
   t->timer.when = 0;
   t->timer.period = period;
+  t->timer.slack = 0;
   t->timer.func = coroc_send_timer;
   t->timer.args = (void *)func;
   t->timer.owner = t;
+  t->timer.shard = NULL;
 }
 
 coroc_timer_t coroc_timer_allocate(uint32_t period, void (*func)(void)) {
@@ -58,7 +125,7 @@ void coroc_timer_dealloc(coroc_timer_t t) {
 }
 
 coroc_chan_t coroc_timer_after(coroc_timer_t t, uint64_t after) {
-  uint64_t curr = coroc_getmicrotime();
+  uint64_t curr = coroc_getcachedtime();
   return coroc_timer_at(t, curr + after);
 }
 
@@ -68,16 +135,48 @@ coroc_chan_t coroc_timer_at(coroc_timer_t t, uint64_t when) {
   return (coroc_chan_t)t;
 }
 
+// start the ticker at the next multiple of its period plus the `phase',
+// so the tickers with different phases never fire at the same time ..
+coroc_chan_t coroc_timer_phase(coroc_timer_t t, uint64_t phase) {
+  uint64_t now = coroc_getcachedtime();
+  uint64_t period = t->timer.period;
+
+  assert(period > 0);
+  uint64_t when = now - now % period + phase % period;
+  if (when <= now) when += period;
+
+  return coroc_timer_at(t, when);
+}
+
+// the number of the ticks dropped since the last call,
+// both the late and the unreceived ones ..
+uint32_t coroc_timer_missed(coroc_timer_t t) {
+  return TSC_XCHG(&t->missed, 0);
+}
+
 int coroc_timer_start(coroc_timer_t t) {
-  if (t->timer.when <= coroc_getmicrotime()) {
-    coroc_send_timer(&t->timer);
+  if (t->timer.when <= coroc_getcachedtime()) {
+    __coroc_timer_send(t, t->timer.when);
     return -1;
   }
 
   return coroc_add_intertimer(&t->timer);
 }
 
-int coroc_timer_stop(coroc_timer_t t) { return coroc_del_intertimer(&t->timer); }
+// applied to every deadline of the timer, the periodic ones are coalesced
+// on each tick without drifting, it must not be running ..
+void coroc_timer_set_slack(coroc_timer_t t, uint32_t slack) {
+  t->timer.slack = slack;
+}
+
+int coroc_timer_stop(coroc_timer_t t) {
+  int ret = coroc_del_intertimer(&t->timer);
+
+  // a scheduler may be still sending the last tick ..
+  while (TSC_ATOMIC_READ(t->firing)) __procyield(16);
+
+  return ret;
+}
 
 int coroc_timer_reset(coroc_timer_t t, uint64_t when) {
   coroc_timer_stop(t);
@@ -88,32 +187,131 @@ int coroc_timer_reset(coroc_timer_t t, uint64_t when) {
 // ---------------------------------------------------
 //
 
-static struct {
+// the timers are sharded per VPU, each timer is added into the shard
+// of the VPU arming it and expired by the schedulers, so there is
+// no global lock and no "timer" daemon ..
+typedef struct coroc_timer_shard {
   coroc_lock lock;
-#if defined(ENABLE_NOTIFY)
-  coroc_notify_t note;
-#endif
+  volatile uint64_t next;  // the earliest deadline, read without the lock
+  coroc_timer_t fired;     // the tickers to send after the expiry
+#if defined(ENABLE_TIMER_WHEEL)
+  coroc_timer_wheel_t wheel;
+#else
   coroc_inter_timer_t **timers;
-  
-  bool suspend;
-
   int32_t cap;
   int32_t size;
-  
-  coroc_coroutine_t daemon;
+#endif
+} coroc_timer_shard_t;
+
+// round the deadline up to the multiple of the largest power of 2
+// not greater than the slack, so the nearby deadlines are coalesced
+// into one bucket and expire together ..
+static inline uint64_t __coroc_timer_coalesce(uint64_t when, uint32_t slack) {
+  uint64_t grain = 1ULL << (31 - __builtin_clz(slack));
+  return (when + grain - 1) & ~(grain - 1);
+}
+
+// move a periodic timer to its next tick on the ideal timeline,
+// so it never drifts, and the ticks already passed are skipped,
+// then coalesce the new deadline like the first one ..
+static inline void __timer_forward(coroc_inter_timer_t *t, uint64_t now) {
+  t->ideal += t->period;
+  if (t->ideal <= now)
+    t->ideal += ((now - t->ideal) / t->period + 1) * t->period;
+
+  t->when = t->ideal;
+  if (t->slack > 1) t->when = __coroc_timer_coalesce(t->when, t->slack);
+}
+
+// called by the expiry with the shard's lock held. the channel's waiters
+// arm their deadlines with the channel's lock held, so the tick must not
+// be sent here, it is queued and sent after the shard's lock is released ..
+static void coroc_send_timer(void *arg) {
+  coroc_timer_t timer = ((coroc_inter_timer_t *)arg)->owner;
+  coroc_timer_shard_t *s = timer->timer.shard;
+
+  // the last tick is not sent yet, drop this one ..
+  if (timer->firing) {
+    TSC_ATOMIC_ADD(timer->missed, 1);
+    return;
+  }
+
+  timer->firing = 1;
+  timer->due = timer->timer.when;
+  timer->next = s->fired;
+  s->fired = timer;
+}
+
+// send the ticks queued by the expiry ..
+static void __coroc_timer_flush(coroc_timer_t fired) {
+  while (fired != NULL) {
+    coroc_timer_t next = fired->next;
+    __coroc_timer_send(fired, fired->due);
+    // the timer may be released once this is cleared ..
+    TSC_SYNC_ALL();
+    TSC_ATOMIC_WRITE(fired->firing, 0);
+    fired = next;
+  }
+}
+
+static struct {
+  uint32_t nshards;
+  coroc_timer_shard_t **shards;
 } coroc_intertimer_manager;
 
-void coroc_intertimer_initialize(void) {
-  coroc_intertimer_manager.size = 0;
-  coroc_intertimer_manager.cap = TSC_DEFAULT_INTERTIMERS_CAP;
-  lock_init(&coroc_intertimer_manager.lock);
-#if defined(ENABLE_NOTIFY)
-  coroc_notify_clear(&coroc_intertimer_manager.note);
-#endif
-  coroc_intertimer_manager.timers =
-      TSC_ALLOC(TSC_DEFAULT_INTERTIMERS_CAP * sizeof(void *));
-  memset(coroc_intertimer_manager.timers, 0,
-         TSC_DEFAULT_INTERTIMERS_CAP * sizeof(void *));
+#if defined(ENABLE_TIMER_WHEEL)
+
+static void __timers_init(coroc_timer_shard_t *s) {
+  coroc_timer_wheel_init(&s->wheel, coroc_getmicrotime());
+}
+
+static inline uint64_t __timers_next(coroc_timer_shard_t *s) {
+  return coroc_timer_wheel_next(&s->wheel);
+}
+
+static inline void __timers_add(coroc_timer_shard_t *s,
+                                coroc_inter_timer_t *timer) {
+  coroc_timer_wheel_add(&s->wheel, timer);
+}
+
+static inline int __timers_del(coroc_timer_shard_t *s,
+                               coroc_inter_timer_t *timer) {
+  return coroc_timer_wheel_del(&s->wheel, timer);
+}
+
+// trigger all the timers expired before `now' in one batch ..
+static void __timers_expire(coroc_timer_shard_t *s, uint64_t now) {
+  coroc_inter_timer_t *t;
+  queue_t expired;
+
+  queue_init(&expired);
+  coroc_timer_wheel_advance(&s->wheel, now, &expired);
+
+  while ((t = queue_rem(&expired)) != NULL) {
+    (t->func)((void *)t);
+    if (t->when > now) {
+      // re-armed by the callback itself ..
+      __timers_add(s, t);
+    } else if (t->period > 0) {
+      __timer_forward(t, now);
+      __timers_add(s, t);
+    } else {
+      t->shard = NULL;
+    }
+  }
+}
+
+#else
+
+static void __timers_init(coroc_timer_shard_t *s) {
+  s->size = 0;
+  s->cap = TSC_DEFAULT_INTERTIMERS_CAP;
+  s->timers = TSC_ALLOC(TSC_DEFAULT_INTERTIMERS_CAP * sizeof(void *));
+  memset(s->timers, 0, TSC_DEFAULT_INTERTIMERS_CAP * sizeof(void *));
+}
+
+static inline uint64_t __timers_next(coroc_timer_shard_t *s) {
+  return (s->size > 0) ? s->timers[0]->when : UINT64_MAX;
 }
 
 // exchange the two elements in the heap
@@ -165,151 +363,220 @@ static void __up_adjust_heap(coroc_inter_timer_t **timers, uint32_t cur) {
   }
 }
 
-// a special corouine will running this,
-// geting a timer which is ready and triger its callback..
-static int coroc_intertimer_routine(void *unused) {
-  // once this routine is started,
-  // it will never stop until the whole system exits ..
-  for (;;) {
-    TSC_SIGNAL_MASK();
-
-    lock_acquire(&coroc_intertimer_manager.lock);
-
-    coroc_inter_timer_t **__timers = coroc_intertimer_manager.timers;
-    int32_t __size = coroc_intertimer_manager.size;
-    uint64_t now = coroc_getmicrotime();
-
-    while (__size > 0) {
-      coroc_inter_timer_t *t = __timers[0];
-
-      if (t->when <= now) {
-        // time out !!
-        (t->func)((void *)t);
-        if (t->period == 0) {
-          // del the timer ..
-          __timers[0]->index = -1;
-          if (--__size > 0) {
-            __timers[0] = __timers[__size];
-            __timers[0]->index = 0;
-          }
-
-          coroc_intertimer_manager.size = __size;
-        } else {
-          // update the `when` field and adjust again ..
-          t->when = now + t->period;
+static void __timers_add(coroc_timer_shard_t *s, coroc_inter_timer_t *timer) {
+  // realloc if need ..
+  if (s->cap == s->size) {
+    s->cap *= 2;
+    s->timers = TSC_REALLOC(s->timers, s->cap * sizeof(void *));
+  }
+
+  s->timers[s->size] = timer;
+  timer->index = s->size;  // fast path for deletion
+  __up_adjust_heap(s->timers, s->size);
+
+  s->size++;
+}
+
+static int __timers_del(coroc_timer_shard_t *s, coroc_inter_timer_t *timer) {
+  coroc_inter_timer_t **__timers = s->timers;
+  int32_t __size = s->size;
+  int32_t i = timer->index;
+
+  if (i < 0 || i >= __size || timer != __timers[i]) return -1;
+
+  __timers[i] = __timers[--__size];
+  __timers[i]->index = i;
+  __down_adjust_heap(__timers, i, __size);
+  s->size = __size;
+  return 0;
+}
+
+// trigger the timers on the top of the heap one by one ..
+static void __timers_expire(coroc_timer_shard_t *s, uint64_t now) {
+  coroc_inter_timer_t **__timers = s->timers;
+  int32_t __size = s->size;
+
+  while (__size > 0) {
+    coroc_inter_timer_t *t = __timers[0];
+
+    if (t->when <= now) {
+      // time out !!
+      (t->func)((void *)t);
+      if (t->when > now) {
+        // re-armed by the callback itself, just adjust it ..
+      } else if (t->period == 0) {
+        // del the timer ..
+        __timers[0]->index = -1;
+        __timers[0]->shard = NULL;
+        if (--__size > 0) {
+          __timers[0] = __timers[__size];
+          __timers[0]->index = 0;
         }
 
-        if (__size > 0) __down_adjust_heap(__timers, 0, __size);
+        s->size = __size;
       } else {
-        break;
+        // update the `when` field and adjust again ..
+        __timer_forward(t, now);
       }
-    }
 
-    // no alive timers here, just suspend myself ..
-    if (__size == 0) {
-      coroc_intertimer_manager.suspend = true;
-      vpu_suspend((void *)(&coroc_intertimer_manager.lock),
-                  (unlock_handler_t)(lock_release));
+      if (__size > 0) __down_adjust_heap(__timers, 0, __size);
     } else {
-      int64_t left = 1000 * (__timers[0]->when - now);
-      lock_release(&coroc_intertimer_manager.lock);
-#if defined(ENABLE_NOTIFY)
-      coroc_notify_tsleep_u(&coroc_intertimer_manager.note, left);
-      coroc_notify_clear(&coroc_intertimer_manager.note);
-#else
-      coroc_coroutine_yield();  // let others run ..
-#endif
+      break;
     }
-
-    TSC_SIGNAL_UNMASK();
   }
-
-  return 0;
 }
 
-// start the "timer" corouine when first add a timer.
-static void coroc_intertimer_start(void) {
-  assert(coroc_intertimer_manager.daemon == NULL);
+#endif  // ENABLE_TIMER_WHEEL
 
-  coroc_coroutine_t daemon = coroc_coroutine_allocate(
-      coroc_intertimer_routine, NULL, "timer", 
-      TSC_COROUTINE_NORMAL, TSC_PRIO_HIGH, NULL);
-  coroc_intertimer_manager.daemon = daemon;
+static inline void __timers_update(coroc_timer_shard_t *s) {
+  TSC_ATOMIC_WRITE(s->next, __timers_next(s));
 }
 
-int coroc_add_intertimer(coroc_inter_timer_t *timer) {
-  TSC_SIGNAL_MASK();
+void coroc_intertimer_initialize(int np, int slack) {
+  uint32_t i;
 
-  int ret = 0;
-  lock_acquire(&coroc_intertimer_manager.lock);
+  if (slack > 0) coroc_timer_slack = slack;
 
-  // realloc if need ..
-  if (coroc_intertimer_manager.cap == coroc_intertimer_manager.size) {
-    coroc_intertimer_manager.cap *= 2;
-    void *p = coroc_intertimer_manager.timers;
-    coroc_intertimer_manager.timers =
-        TSC_REALLOC(p, coroc_intertimer_manager.cap * sizeof(void *));
+#if defined(ENABLE_TSC_CLOCK)
+  __coroc_tsc_calibrate();
+#endif
+
+  coroc_intertimer_manager.nshards = np;
+  coroc_intertimer_manager.shards =
+      TSC_ALLOC(np * sizeof(coroc_timer_shard_t *));
+
+  for (i = 0; i < np; i++) {
+    coroc_timer_shard_t *s = TSC_ALLOC(sizeof(coroc_timer_shard_t));
+    lock_init(&s->lock);
+    __timers_init(s);
+    s->next = UINT64_MAX;
+    s->fired = NULL;
+    coroc_intertimer_manager.shards[i] = s;
   }
+}
 
-  coroc_inter_timer_t **__timers = coroc_intertimer_manager.timers;
-  int32_t __size = coroc_intertimer_manager.size;
-
-  __timers[__size] = timer;
-  timer->index = __size;  // fast path for deletion
-  __up_adjust_heap(__timers, __size);
-
-  coroc_intertimer_manager.size++;
-
-  if (coroc_intertimer_manager.daemon == NULL) {
-    coroc_intertimer_start();
-  } else if (__size == 0) {
-    // awaken the timer daemon thread ..
-    if (coroc_intertimer_manager.suspend) {
-      coroc_intertimer_manager.suspend = false;
-      lock_release(&coroc_intertimer_manager.lock);
-      // NOTE: must release the lock before calling `vpu_ready()' !!
-      vpu_ready(coroc_intertimer_manager.daemon, true);
-      goto __exit;
-    }
+// called by the scheduler of each VPU in every loop,
+// run the expired timers of all the shards, starting from its own one,
+// so the timers of the sleeping VPUs will not be delayed.
+// NOTE: the internal callbacks run on the scheduler's context
+// with the shard's lock held, so they must never block !!
+// the tickers' user callbacks and sends run after the lock is released.
+void coroc_intertimer_expire(uint32_t id) {
+  uint32_t i, n = coroc_intertimer_manager.nshards;
+  uint64_t now = 0;
+  coroc_timer_t fired;
+
+  for (i = 0; i < n; i++) {
+    coroc_timer_shard_t *s = coroc_intertimer_manager.shards[(id + i) % n];
+    uint64_t next = TSC_ATOMIC_READ(s->next);
+
+    if (next == UINT64_MAX) continue;
+    if (now == 0) now = coroc_getcachedtime();
+    if (next > now) continue;
+
+    // someone else is handling this shard ..
+    if (lock_try_acquire(&s->lock) != 0) continue;
+    __timers_expire(s, now);
+    __timers_update(s);
+    fired = s->fired;
+    s->fired = NULL;
+    lock_release(&s->lock);
+
+    __coroc_timer_flush(fired);
   }
-#if defined(ENABLE_NOTIFY)
-  else {
-    coroc_notify_wakeup(&coroc_intertimer_manager.note);
+}
+
+// the earliest deadline of all the shards,
+// the last awake VPU sleeps until this time ..
+uint64_t coroc_intertimer_next(void) {
+  uint32_t i;
+  uint64_t next = UINT64_MAX;
+
+  for (i = 0; i < coroc_intertimer_manager.nshards; i++) {
+    uint64_t when = TSC_ATOMIC_READ(coroc_intertimer_manager.shards[i]->next);
+    if (when < next) next = when;
   }
-#endif
-  lock_release(&coroc_intertimer_manager.lock);
 
-__exit:
-  TSC_SIGNAL_UNMASK();
-  return ret;
+  return next;
 }
 
-int coroc_del_intertimer(coroc_inter_timer_t *timer) {
-  int ret = -1;
+// the async threads use the first shard ..
+static inline coroc_timer_shard_t *__coroc_timer_shard(void) {
+  vpu_t *vpu = TSC_TLS_GET();
+  return coroc_intertimer_manager.shards[vpu != NULL ? vpu->id : 0];
+}
 
-  lock_acquire(&coroc_intertimer_manager.lock);
+static inline void __coroc_timer_arm(coroc_timer_shard_t *s,
+                                     coroc_inter_timer_t *timer) {
+  timer->shard = s;
+  __timers_add(s, timer);
+  if (timer->when < s->next) TSC_ATOMIC_WRITE(s->next, __timers_next(s));
+}
 
-  coroc_inter_timer_t **__timers = coroc_intertimer_manager.timers;
-  int32_t __size = coroc_intertimer_manager.size;
-  int32_t i = timer->index;
+int coroc_add_intertimer(coroc_inter_timer_t *timer) {
+  timer->ideal = timer->when;
+  if (timer->slack > 1)
+    timer->when = __coroc_timer_coalesce(timer->when, timer->slack);
 
-  if (i < 0 || i >= __size || timer != __timers[i]) goto __exit_del_intertimer;
+  TSC_SIGNAL_MASK();
 
-  __timers[i] = __timers[--__size];
-  __timers[i]->index = i;
-  __down_adjust_heap(__timers, i, __size);
-  coroc_intertimer_manager.size = __size;
-  ret = 0;
+  coroc_timer_shard_t *s = __coroc_timer_shard();
+  lock_acquire(&s->lock);
+  __coroc_timer_arm(s, timer);
+  lock_release(&s->lock);
 
-__exit_del_intertimer:
-  lock_release(&coroc_intertimer_manager.lock);
+  TSC_SIGNAL_UNMASK();
+  return 0;
+}
+
+int coroc_del_intertimer(coroc_inter_timer_t *timer) {
+  coroc_timer_shard_t *s = TSC_ATOMIC_READ(timer->shard);
+  int ret = -1;
+
+  // already expired or never started ..
+  if (s == NULL) return -1;
+
+  TSC_SIGNAL_MASK();
+  lock_acquire(&s->lock);
+  if (timer->shard == s && (ret = __timers_del(s, timer)) == 0) {
+    timer->shard = NULL;
+    __timers_update(s);
+  }
+  lock_release(&s->lock);
+  TSC_SIGNAL_UNMASK();
 
   return ret;
 }
 
+static void __coroc_udelay_wakeup(void *arg) {
+  coroc_inter_timer_t *timer = (coroc_inter_timer_t *)arg;
+  vpu_ready((coroc_coroutine_t)timer->args, false);
+}
+
+// the sleeping coroutine is linked into the timers directly,
+// and it is readied by the expiry without any channel ..
 void coroc_udelay(uint64_t us) {
-  // initialize a coroc_timer on stack !!
-  struct coroc_timer timer;
-  __coroc_timer_init(&timer, 0, 0);
-  coroc_chan_recv(coroc_timer_after(&timer, us), NULL);
+  coroc_inter_timer_t timer;
+
+  timer.when = coroc_getcachedtime() + us;
+  timer.period = 0;
+  timer.slack = 0;
+  timer.func = __coroc_udelay_wakeup;
+  timer.args = coroc_coroutine_self();
+  timer.owner = NULL;
+
+  TSC_SIGNAL_MASK();
+
+  // the shard's lock is released after the current coroutine
+  // is suspended, so it can't be readied before that ..
+  coroc_timer_shard_t *s = __coroc_timer_shard();
+  lock_acquire(&s->lock);
+  __coroc_timer_arm(s, &timer);
+  vpu_suspend(&s->lock, (unlock_handler_t)lock_release);
+
+  // the expiry may still be using the timer on our stack,
+  // so wait for it like the other timed waits do ..
+  coroc_del_intertimer(&timer);
+
+  TSC_SIGNAL_UNMASK();
 }
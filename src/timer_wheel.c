@@ -0,0 +1,167 @@
+// Copyright 2016 Amal Cao (amalcaowei@gmail.com). All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.txt file.
+
+#include <string.h>
+#include <assert.h>
+
+#include "coroc_timer_wheel.h"
+
+#define TSC_TIMER_WHEEL_RANGE \
+  (1ULL << (TSC_TIMER_WHEEL_BITS * TSC_TIMER_WHEEL_LEVELS))
+
+static inline void __bitmap_set(uint64_t *bitmap, uint32_t i) {
+  bitmap[i >> 6] |= (1ULL << (i & 63));
+}
+
+static inline void __bitmap_clear(uint64_t *bitmap, uint32_t i) {
+  bitmap[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+// find the first set bit from `i', return SLOTS if not found ..
+static inline uint32_t __bitmap_next(uint64_t *bitmap, uint32_t i) {
+  while (i < TSC_TIMER_WHEEL_SLOTS) {
+    uint64_t word = bitmap[i >> 6] & (~0ULL << (i & 63));
+    if (word != 0) return (i & ~63) + __builtin_ctzll(word);
+    i = (i & ~63) + 64;
+  }
+  return TSC_TIMER_WHEEL_SLOTS;
+}
+
+static inline bool __bitmap_empty(uint64_t *bitmap) {
+  uint32_t i;
+  for (i = 0; i < TSC_TIMER_WHEEL_SLOTS / 64; i++)
+    if (bitmap[i] != 0) return false;
+  return true;
+}
+
+static inline bool __in_wheel(coroc_timer_wheel_t *wheel, queue_t *que) {
+  queue_t *first = &wheel->slots[0][0];
+  return que >= first &&
+         que < first + TSC_TIMER_WHEEL_LEVELS * TSC_TIMER_WHEEL_SLOTS;
+}
+
+// put the timer into the slot by its distance from the current tick,
+// the late ones go to the current slot and will expire next time ..
+static void __wheel_place(coroc_timer_wheel_t *wheel,
+                          coroc_inter_timer_t *timer) {
+  uint64_t when = timer->when > wheel->curr ? timer->when : wheel->curr;
+  uint64_t delta = when - wheel->curr;
+  uint32_t level = 0, slot;
+
+  if (delta >= TSC_TIMER_WHEEL_RANGE) {
+    when = wheel->curr + TSC_TIMER_WHEEL_RANGE - 1;
+    delta = TSC_TIMER_WHEEL_RANGE - 1;
+  }
+
+  while (delta >> (TSC_TIMER_WHEEL_BITS * (level + 1))) level++;
+
+  slot = (when >> (TSC_TIMER_WHEEL_BITS * level)) & TSC_TIMER_WHEEL_MASK;
+  // the stale links must be cleared, `queue_add' won't do that ..
+  queue_item_init(&timer->link, timer);
+  queue_add(&wheel->slots[level][slot], &timer->link);
+  __bitmap_set(wheel->bitmap[level], slot);
+}
+
+// move the timers in the current slot of given level to the lower levels,
+// the upper level must be cascaded first if the current slot is the first ..
+static void __wheel_cascade(coroc_timer_wheel_t *wheel, uint32_t level) {
+  uint32_t slot = (wheel->curr >> (TSC_TIMER_WHEEL_BITS * level)) &
+                  TSC_TIMER_WHEEL_MASK;
+
+  if (slot == 0 && level + 1 < TSC_TIMER_WHEEL_LEVELS)
+    __wheel_cascade(wheel, level + 1);
+
+  queue_t *que = &wheel->slots[level][slot];
+  if (que->status == 0) return;
+
+  // detach the whole list first, since the far timers
+  // may be put back into the same slot ..
+  queue_item_t *item = que->head;
+  queue_init(que);
+  __bitmap_clear(wheel->bitmap[level], slot);
+
+  while (item != NULL) {
+    coroc_inter_timer_t *timer = item->owner;
+    item = item->next;
+    __wheel_place(wheel, timer);
+  }
+}
+
+void coroc_timer_wheel_init(coroc_timer_wheel_t *wheel, uint64_t now) {
+  uint32_t i, j;
+
+  wheel->curr = now;
+  wheel->size = 0;
+  memset(wheel->bitmap, 0, sizeof(wheel->bitmap));
+  for (i = 0; i < TSC_TIMER_WHEEL_LEVELS; i++)
+    for (j = 0; j < TSC_TIMER_WHEEL_SLOTS; j++)
+      queue_init(&wheel->slots[i][j]);
+}
+
+void coroc_timer_wheel_add(coroc_timer_wheel_t *wheel,
+                           coroc_inter_timer_t *timer) {
+  __wheel_place(wheel, timer);
+  wheel->size++;
+}
+
+int coroc_timer_wheel_del(coroc_timer_wheel_t *wheel,
+                          coroc_inter_timer_t *timer) {
+  queue_t *que = timer->link.que;
+  if (!__in_wheel(wheel, que)) return -1;
+
+  queue_extract(que, &timer->link);
+  if (que->status == 0) {
+    uint32_t i = que - &wheel->slots[0][0];
+    __bitmap_clear(wheel->bitmap[i / TSC_TIMER_WHEEL_SLOTS],
+                   i % TSC_TIMER_WHEEL_SLOTS);
+  }
+
+  wheel->size--;
+  return 0;
+}
+
+uint64_t coroc_timer_wheel_next(coroc_timer_wheel_t *wheel) {
+  uint32_t level;
+
+  // the first candidate of the lower level is always earlier
+  // than any of the upper levels ..
+  for (level = 0; level < TSC_TIMER_WHEEL_LEVELS; level++) {
+    uint32_t shift = TSC_TIMER_WHEEL_BITS * level;
+    uint32_t slot = (wheel->curr >> shift) & TSC_TIMER_WHEEL_MASK;
+    uint64_t base = (wheel->curr >> shift) - slot;
+    // the current slot of the upper levels is for the next round ..
+    uint32_t next =
+        __bitmap_next(wheel->bitmap[level], level ? slot + 1 : slot);
+
+    if (next < TSC_TIMER_WHEEL_SLOTS) return (base + next) << shift;
+    // wake up at the end of this round to cascade ..
+    if (!__bitmap_empty(wheel->bitmap[level]))
+      return (base + TSC_TIMER_WHEEL_SLOTS) << shift;
+  }
+
+  return UINT64_MAX;
+}
+
+void coroc_timer_wheel_advance(coroc_timer_wheel_t *wheel, uint64_t now,
+                               queue_t *expired) {
+  while (wheel->size > 0 && wheel->curr <= now) {
+    uint32_t slot = wheel->curr & TSC_TIMER_WHEEL_MASK;
+    if (slot == 0) __wheel_cascade(wheel, 1);
+
+    queue_t *que = &wheel->slots[0][slot];
+    coroc_inter_timer_t *timer;
+    while ((timer = queue_rem(que)) != NULL) {
+      queue_add(expired, &timer->link);
+      wheel->size--;
+    }
+    __bitmap_clear(wheel->bitmap[0], slot);
+
+    // skip the empty slots ..
+    uint64_t next = coroc_timer_wheel_next(wheel);
+    assert(next > wheel->curr);
+    wheel->curr = (next <= now) ? next : now + 1;
+  }
+
+  if (wheel->curr <= now) wheel->curr = now + 1;
+}
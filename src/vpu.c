@@ -236,6 +236,21 @@ static inline coroc_coroutine_t core_elect(vpu_t *vpu, unsigned prio) {
 // the VPU thread should go to sleep and wait for other
 // to wakeup it.
 //
+// convert the deadline of the runtime clock to the absolute time
+// of the condition variable's clock, they may differ with the TSC ..
+static void __coroc_abstime(struct timespec *abstime, uint64_t when) {
+  int64_t delta = (int64_t)when - coroc_getmicrotime();
+  if (delta < 0) delta = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, abstime);
+  abstime->tv_sec += delta / 1000000;
+  abstime->tv_nsec += (delta % 1000000) * 1000;
+  if (abstime->tv_nsec >= 1000000000) {
+    abstime->tv_sec++;
+    abstime->tv_nsec -= 1000000000;
+  }
+}
+
 static void core_sched(void) {
   vpu_t* vpu = TSC_TLS_GET();
   coroc_coroutine_t candidate = NULL;
@@ -250,6 +265,18 @@ static void core_sched(void) {
   /* --- the actual loop -- */
   while (true) {
     unsigned prio;
+
+    // the cached time is stale now, then trigger the expired timers ..
+    vpu->now = 0;
+    coroc_intertimer_expire(vpu->id);
+
+    // the VPU may never be idle, submit and reap the net IO requests
+    // of each shard in turn, or the coroutines waiting may starve ..
+    if ((++vpu->passes & (TSC_NETPOLL_POLL_PASSES - 1)) == 0) {
+      unsigned turn = vpu->passes / TSC_NETPOLL_POLL_PASSES;
+      __coroc_netpoll_polling((vpu->id + turn) % vpu_manager.xt_index, 0);
+    }
+
     for (prio = 0; prio < TSC_PRIO_NUM; ++prio) {
       // ignore the 
       if (TSC_ATOMIC_READ(vpu_manager.ready[prio]) == 0) continue;
@@ -258,14 +285,26 @@ static void core_sched(void) {
       candidate = __runqget(& vpu->xt[prio]);
 
       if (candidate == NULL) {
-        // polling the async net IO ..
-        __coroc_netpoll_polling(0);
+        // polling the async net IO of this VPU's shard,
+        // the readied waiters are put into the private queue ..
+        if (__coroc_netpoll_polling(vpu->id, 0))
+          candidate = __runqget(& vpu->xt[prio]);
+      }
 
+      if (candidate == NULL) {
         // try to fetch tasks from the global queue,
         // or stealing from other VPUs' queue ..
         candidate = core_elect(vpu, prio);
       }
 
+      if (candidate == NULL && vpu_manager.xt_index > 1) {
+        // the busy VPUs don't poll their shards, so steal the IO work
+        // from a random one, the woken tasks then run here ..
+        int victim_id = __myrand(vpu) % (vpu_manager.xt_index);
+        if (victim_id != vpu->id && __coroc_netpoll_polling(victim_id, 0))
+          candidate = __runqget(& vpu->xt[prio]);
+      }
+
       if (candidate != NULL) {
         assert(candidate->priority == prio);
 
@@ -287,6 +326,7 @@ static void core_sched(void) {
         TSC_SIGNAL_STATE_LOAD(&candidate->sigmask_nest);
 
         vpu->current = candidate;  // important !!
+        vpu->now = 0;  // the candidate reads its own cached time ..
 #ifdef ENABLE_SPLITSTACK
         TSC_STACK_CONTEXT_LOAD(&candidate->ctx);
 #endif
@@ -295,13 +335,20 @@ static void core_sched(void) {
       }
     } // for each priority level ..
 
+    // nothing to run, submit the net IO requests batched so far ..
+    __coroc_netpoll_flush(vpu->id);
+
     if (++idle_loops > MAX_SPIN_LOOP_NUM) {
       pthread_mutex_lock(&vpu_manager.lock);
       vpu_manager.alive--;
 
+      // the earliest deadline of all the timers ..
+      uint64_t next = coroc_intertimer_next();
+
       if (vpu_manager.alive > 0 || 
           (TSC_ATOMIC_READ(vpu_manager.total_ready) == 0 &&
-           TSC_ATOMIC_READ(vpu_manager.total_iowait) > 0)) {
+           TSC_ATOMIC_READ(vpu_manager.total_iowait) > 0 &&
+           next == UINT64_MAX)) {
         // if this vpu is not the last awake one or 
         // there're some running async io tasks, go sleep ..
         TSC_ATOMIC_DEC(vpu_manager.idle);
@@ -313,7 +360,7 @@ static void core_sched(void) {
         if (__coroc_netpoll_size() > 0) {
           // block on the netpoll set for 1 ms..
 #if 0
-          if (! __coroc_netpoll_polling(1) &&
+          if (! __coroc_netpoll_polling(-1, 1) &&
               TSC_ATOMIC_READ(vpu_manager.total_ready) == 0) {
             // if no task is ready during polling,
             // suspend the current scheduler thread!!
@@ -329,16 +376,35 @@ static void core_sched(void) {
           vpu_manager.alive++;
           pthread_mutex_unlock(&vpu_manager.lock);
 
+          // the earliest timer wakes up the polling as an event,
+          // or it is checked after each polling ..
+          // block until the armed timer or one net job, otherwise back
+          // off the polling from 1 ms to 1 s ..
           int timeout = 1;
-          while (! __coroc_netpoll_polling(timeout) &&
-                 TSC_ATOMIC_READ(vpu_manager.total_ready) == 0) {
-            timeout << 1;
-                if (timeout > 1000) timeout = 1000;
+          if (next != UINT64_MAX && __coroc_netpoll_timer(next) == 0)
+            timeout = -1;
+
+          while (! __coroc_netpoll_polling(-1, timeout) &&
+                 TSC_ATOMIC_READ(vpu_manager.total_ready) == 0 &&
+                 coroc_intertimer_next() > coroc_getmicrotime()) {
+            if (timeout > 0) {
+              timeout <<= 1;
+              if (timeout > 1000) timeout = 1000;
+            }
           }
 
           continue;
 #endif
         }
+        /* the last awake VPU waits for the earliest timer .. */
+        else if (next != UINT64_MAX) {
+          struct timespec abstime;
+          __coroc_abstime(&abstime, next);
+          TSC_ATOMIC_DEC(vpu_manager.idle);
+          pthread_cond_timedwait(&vpu_manager.cond, &vpu_manager.lock,
+                                 &abstime);
+          TSC_ATOMIC_INC(vpu_manager.idle);
+        }
         /* no any ready coroutines, just halt .. */
         else/* if (vpu_manager.total_ready == 0)*/
           vpu_backtrace(vpu);
@@ -422,7 +488,9 @@ static void* per_vpu_initalize(void* vpu_id) {
   vpu_t* vpu = &vpu_manager.vpu[((coroc_word_t)vpu_id)];
   vpu->id = (int)((coroc_word_t)vpu_id);
   vpu->ticks = 0;
+  vpu->passes = 0;
   vpu->watchdog = 0;
+  vpu->now = 0;
 
   // add by zhj, init the rand seed.
   __mysrand(vpu, vpu->id + 1);
@@ -432,6 +500,8 @@ static void* per_vpu_initalize(void* vpu_id) {
     __priv_task_queue_init(& vpu->xt[prio], prio);
   }
 
+  coroc_slab_cache_init(vpu->slab);
+
   TSC_TLS_SET(vpu);
 
   // initialize the system scheduler coroutine ..
@@ -498,7 +568,14 @@ void coroc_vpu_initialize(int vpu_mp_count, coroc_coroutine_handler_t entry) {
   vpu_manager.idle = 0;
   vpu_manager.total_ready = 0;
 
-  pthread_cond_init(&vpu_manager.cond, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+#if !defined(__APPLE__)
+  // the timed wait is driven by the monotonic timers ..
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+  pthread_cond_init(&vpu_manager.cond, &attr);
+  pthread_condattr_destroy(&attr);
   pthread_mutex_init(&vpu_manager.lock, NULL);
 
   TSC_BARRIER_INIT(vpu_manager.xt_index + 1);
@@ -524,11 +601,9 @@ void coroc_vpu_initialize(int vpu_mp_count, coroc_coroutine_handler_t entry) {
   TSC_BARRIER_WAIT();
 }
 
-// make the given coroutine runnable,
-// change its state and link it to the running queue.
-void vpu_ready(coroc_coroutine_t coroutine, bool preempt) {
-  vpu_t *vpu = TSC_TLS_GET();
-
+// change the state of the given coroutine and link it to
+// the running queue, but not try to wakeup any sleeping VPU.
+static inline void __vpu_ready(vpu_t *vpu, coroc_coroutine_t coroutine) {
   assert(coroutine != NULL &&
          coroutine->status == TSC_COROUTINE_WAIT);
 
@@ -549,6 +624,14 @@ void vpu_ready(coroc_coroutine_t coroutine, bool preempt) {
 
   if (coroutine->async_wait)
     TSC_ATOMIC_DEC(vpu_manager.total_iowait);
+}
+
+// make the given coroutine runnable,
+// change its state and link it to the running queue.
+void vpu_ready(coroc_coroutine_t coroutine, bool preempt) {
+  vpu_t *vpu = TSC_TLS_GET();
+
+  __vpu_ready(vpu, coroutine);
 
   if ( preempt && (vpu != NULL) &&
        (vpu->current->priority > coroutine->priority) &&
@@ -561,6 +644,20 @@ void vpu_ready(coroc_coroutine_t coroutine, bool preempt) {
   }
 }
 
+// make a batch of coroutines runnable at once,
+// only one sleeping VPU will be awaken for the whole batch.
+void vpu_ready_batch(coroc_coroutine_t *coroutines, int n) {
+  vpu_t *vpu = TSC_TLS_GET();
+  int i;
+
+  if (n <= 0) return;
+
+  for (i = 0; i < n; ++i)
+    __vpu_ready(vpu, coroutines[i]);
+
+  vpu_wakeup_one();
+}
+
 // call the core functions on a system (idle) coroutine's stack context,
 // in order to prevent the conpetition among the VPUs.
 void vpu_syscall(int (*pfn)(void*)) {